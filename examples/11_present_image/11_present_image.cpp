@@ -1,17 +1,49 @@
 #include "imr/imr.h"
 #include "imr/util.h"
 
-int main() {
-    glfwInit();
-    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    auto window = glfwCreateWindow(1024, 1024, "Example", nullptr, nullptr);
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+
+int main(int argc, char** argv) {
+    // --headless N renders N frames without a window and exits, for running on machines without a display
+    int headless_frames = 0;
+    // --max-fps N caps the frame rate, headless runs then check how steady the pacing was
+    int max_fps = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc) {
+            headless_frames = atoi(argv[++i]);
+        }
+        if (strcmp(argv[i], "--max-fps") == 0 && i + 1 < argc) {
+            max_fps = atoi(argv[++i]);
+        }
+    }
+
+    GLFWwindow* window = nullptr;
+    if (!headless_frames) {
+        glfwInit();
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        window = glfwCreateWindow(1024, 1024, "Example", nullptr, nullptr);
+    }
 
     imr::Context context;
     imr::Device device(context);
-    imr::Swapchain swapchain(device, window);
+    auto swapchain_ptr = window ? std::make_unique<imr::Swapchain>(device, window) : std::make_unique<imr::Swapchain>(device, VkExtent2D { 1024, 1024 });
+    auto& swapchain = *swapchain_ptr;
+    if (max_fps)
+        swapchain.maxFps = max_fps;
     imr::FpsCounter fps_counter;
 
-    while (!glfwWindowShouldClose(window)) {
+    if (headless_frames) {
+        // Nobody will look at these, check we got what we asked for
+        swapchain.onFrameReadback = [](size_t frame_id, VkExtent2D size, const void* pixels) {
+            auto first_pixel = static_cast<const uint8_t*>(pixels);
+            if (frame_id == 0)
+                printf("First frame: %dx%d, first pixel = (%d, %d, %d, %d)\n", size.width, size.height, first_pixel[0], first_pixel[1], first_pixel[2], first_pixel[3]);
+        };
+    }
+
+    for (int frame = 0; window ? !glfwWindowShouldClose(window) : frame < headless_frames; frame++) {
         // This helper function asks the swapchain for an image and prepares for rendering to it
         // It also allocates a commandbuffer for us, and prepares it for command recording
         //
@@ -36,10 +68,28 @@ int main() {
 
         // This tracks the fps (cpu-side)
         fps_counter.tick();
+        if (!window)
+            continue;
         fps_counter.updateGlfwWindowTitle(window);
         // We need to call this to know if someone tried to close the window
         glfwPollEvents();
     }
 
+    if (!window)
+        printf("Rendered %d frames, %d fps on average\n", headless_frames, fps_counter.average_fps());
+
+    auto pacing = swapchain.pacingStats();
+    if (!window && pacing.target_frametime > 0) {
+        printf("Pacing: target %.3fms, average %.3fms, deviation %.3fms, error %.3fms\n", pacing.target_frametime * 1000.0f,
+               pacing.average_frametime * 1000.0f, pacing.frametime_deviation * 1000.0f, pacing.average_error * 1000.0f);
+        // Loose bounds, this is meant to catch a pacer that's broken rather than one having a bad day on a busy machine
+        bool steady = std::abs(pacing.average_frametime - pacing.target_frametime) < pacing.target_frametime * 0.05f
+                   && pacing.frametime_deviation < pacing.target_frametime * 0.1f;
+        if (!steady) {
+            fprintf(stderr, "Frame pacing is off the target\n");
+            return 1;
+        }
+    }
+
     return 0;
 }
@@ -2,6 +2,7 @@
 #include "imr/util.h"
 
 #include <cmath>
+#include <cstddef>
 #include "nasl/nasl.h"
 #include "nasl/nasl_mat.h"
 
@@ -99,6 +100,9 @@ struct {
     VkDeviceAddress matrices_buffer;
     uint32_t instances_count;
     float time;
+    /// Only in the bindless variant, which finds the images by their index in the heap
+    uint32_t render_target;
+    uint32_t depth_buffer;
 } push_constants_instanced;
 
 struct {
@@ -125,6 +129,11 @@ CameraInput camera_input;
 void camera_update(GLFWwindow*, CameraInput* input);
 
 bool reload_shaders = false;
+bool print_gpu_stats = false;
+bool toggle_descriptor_buffers = false;
+bool toggle_bindless = false;
+/// Whether the next Shaders use the bindless heap for the instanced mode
+bool use_bindless = false;
 
 #define INSTANCES_COUNT 16
 
@@ -146,25 +155,85 @@ struct PreprocessedTri {
 };
 
 TriDrawMode mode = SINGLE;
+const char* mode_names[] = { "single", "batched", "instanced", "pipelined" };
+// the GPU profiler keeps the scopes apart by name, so each descriptor path gets its own
+const char* descriptor_buffer_mode_names[] = { "single, descriptor buffers", "batched, descriptor buffers", "instanced, descriptor buffers", "pipelined, descriptor buffers" };
 
+/// The pipelines all build in parallel on the device's compile threads, using one waits for it to be ready
 struct Shaders {
-    imr::ComputePipeline single;
-    imr::ComputePipeline batched;
-    imr::ComputePipeline instanced;
-    imr::ComputePipeline pipelined_triangles;
-    imr::ComputePipeline pipelined_raster;
+    /// Workgroups are square, as big as the device allows up to 32x32. The shaders get it through specialization constants 0 and 1.
+    uint32_t workgroup_size;
+    /// Device::use_descriptor_buffers when these were built, that's when it counts
+    bool descriptor_buffers;
+    /// Likewise for use_bindless
+    bool bindless;
+
+    imr::AsyncPipeline<imr::ComputePipeline> single;
+    imr::AsyncPipeline<imr::ComputePipeline> batched;
+    imr::AsyncPipeline<imr::ComputePipeline> instanced;
+    imr::AsyncPipeline<imr::ComputePipeline> pipelined_triangles;
+    imr::AsyncPipeline<imr::ComputePipeline> pipelined_raster;
+
+    static uint32_t pick_workgroup_size(imr::Device& d) {
+        auto& limits = d.physical_device.properties.limits;
+        uint32_t size = 32;
+        while (size > 1 && (size * size > limits.maxComputeWorkGroupInvocations || size > limits.maxComputeWorkGroupSize[0] || size > limits.maxComputeWorkGroupSize[1]))
+            size /= 2;
+        return size;
+    }
+
+    /// The heap is looked up here rather than on the compile thread, that's where the Device is used from
+    imr::AsyncPipeline<imr::ComputePipeline> build(imr::Device& d, std::string filename, imr::BindlessHeap* heap = nullptr) {
+        imr::SpecializationConstants specialization = { { 0, workgroup_size }, { 1, workgroup_size } };
+        return d.compileAsync<imr::ComputePipeline>([&d, filename, specialization, heap]() mutable {
+            return std::make_unique<imr::ComputePipeline>(d, std::move(filename), "main", std::move(specialization), imr::PipelineOptions { .push_descriptors = true, .bindless = heap });
+        });
+    }
 
     Shaders(imr::Device& d) :
-        single(d, "15_compute_cubes.spv"),
-        batched(d, "15_compute_cubes_batched.spv"),
-        instanced(d, "15_compute_cubes_instanced.spv"),
-        pipelined_triangles(d, "15_compute_cubes_pipelined_triangles.spv"),
-        pipelined_raster(d, "15_compute_cubes_pipelined_raster.spv")
+        workgroup_size(pick_workgroup_size(d)),
+        descriptor_buffers(d.use_descriptor_buffers),
+        bindless(use_bindless),
+        single(build(d, "15_compute_cubes.spv")),
+        batched(build(d, "15_compute_cubes_batched.spv")),
+        instanced(bindless ? build(d, "15_compute_cubes_instanced_bindless.spv", &d.bindless()) : build(d, "15_compute_cubes_instanced.spv")),
+        pipelined_triangles(build(d, "15_compute_cubes_pipelined_triangles.spv")),
+        pipelined_raster(build(d, "15_compute_cubes_pipelined_raster.spv"))
         {}
+
+    bool ready() const {
+        return single.ready() && batched.ready() && instanced.ready() && pipelined_triangles.ready() && pipelined_raster.ready();
+    }
+
+    /// Throws if any of them failed to build
+    void check() {
+        single.get();
+        batched.get();
+        instanced.get();
+        pipelined_triangles.get();
+        pipelined_raster.get();
+    }
+
+    /// How the shaders get their images, for telling the frame times apart
+    const char* binding_name() const {
+        if (descriptor_buffers)
+            return "descriptor buffers";
+        return bindless ? "bindless" : "descriptor sets";
+    }
 };
 
 int main(int argc, char** argv) {
+    // where the frame times go when we're done, for looking at stutters offline
+    const char* frametimes_csv = nullptr;
+    // likewise for a trace of the CPU and GPU work, which opens in ui.perfetto.dev
+    const char* trace_json = nullptr;
     for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--frametimes-csv") == 0 && i + 1 < argc) {
+            frametimes_csv = argv[++i];
+        }
+        if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_json = argv[++i];
+        }
         if (strcmp(argv[i], "--batched") == 0) {
             mode = BATCHED;
         }
@@ -174,6 +243,10 @@ int main(int argc, char** argv) {
         if (strcmp(argv[i], "--pipelined") == 0) {
             mode = PIPELINED;
         }
+        // start out with descriptor buffers, for comparing runs with --frametimes-csv
+        if (strcmp(argv[i], "--descriptor-buffers") == 0) {
+            toggle_descriptor_buffers = true;
+        }
     }
 
     glfwInit();
@@ -183,13 +256,35 @@ int main(int argc, char** argv) {
     glfwSetKeyCallback(window, [](GLFWwindow* window, int key, int scancode, int action, int mods) {
         if (key == GLFW_KEY_R && (mods & GLFW_MOD_CONTROL))
             reload_shaders = true;
+        if (key == GLFW_KEY_P && action == GLFW_PRESS)
+            print_gpu_stats = true;
+        if (key == GLFW_KEY_D && action == GLFW_PRESS)
+            toggle_descriptor_buffers = true;
+        if (key == GLFW_KEY_B && action == GLFW_PRESS)
+            toggle_bindless = true;
     });
 
     imr::Context context;
     imr::Device device(context);
+    std::unique_ptr<imr::Tracer> tracer;
+    if (trace_json)
+        tracer = std::make_unique<imr::Tracer>(device);
+    if (toggle_descriptor_buffers && device.descriptor_buffer_supported)
+        device.use_descriptor_buffers = true;
+    toggle_descriptor_buffers = false;
     imr::Swapchain swapchain(device, window);
     imr::FpsCounter fps_counter;
+    // Press P to print how long the GPU spends drawing the cubes, and a histogram of the frame times
+    imr::GpuProfiler profiler(swapchain);
     auto shaders = std::make_unique<Shaders>(device);
+    // the shaders being rebuilt, we keep rendering with the current ones until they are ready
+    std::unique_ptr<Shaders> next_shaders;
+
+    // Press D to switch between descriptor sets and descriptor buffers. Frame times are kept for each separately,
+    // and printed when switching away. The GPU time of each is under its own name when pressing P.
+    // B does the same for the bindless heap in the instanced mode (--instanced), where the images are passed by index.
+    auto binding_frametimes = std::make_unique<imr::FpsCounter>();
+    const char* measured_binding = shaders->binding_name();
 
     auto cube = make_cube();
 
@@ -231,16 +326,57 @@ int main(int argc, char** argv) {
     while (!glfwWindowShouldClose(window)) {
         fps_counter.tick();
         fps_counter.updateGlfwWindowTitle(window);
+        if (strcmp(shaders->binding_name(), measured_binding) != 0) {
+            auto frametimes = binding_frametimes->percentiles();
+            printf("%s: p50 %.3fms, p95 %.3fms, p99 %.3fms, 1%% low %.1f fps\n", measured_binding,
+                   frametimes.p50 * 1000.0f, frametimes.p95 * 1000.0f, frametimes.p99 * 1000.0f, frametimes.one_percent_low_fps);
+            binding_frametimes = std::make_unique<imr::FpsCounter>();
+            measured_binding = shaders->binding_name();
+        }
+        binding_frametimes->tick();
 
         swapchain.renderFrameSimplified([&](imr::Swapchain::SimplifiedRenderContext& context) {
             camera_update(window, &camera_input);
             camera_move_freelook(&camera, &camera_input, &camera_state, delta);
 
+            // The pipelines are made for one or the other, so they get rebuilt. The ones already building keep what the flag was when they were queued.
+            if (toggle_descriptor_buffers && !next_shaders && shaders->ready()) {
+                if (use_bindless) {
+                    fprintf(stderr, "The bindless heap doesn't work with descriptor buffers\n");
+                } else if (device.descriptor_buffer_supported) {
+                    device.use_descriptor_buffers = !device.use_descriptor_buffers;
+                    reload_shaders = true;
+                } else {
+                    fprintf(stderr, "VK_EXT_descriptor_buffer isn't supported\n");
+                }
+                toggle_descriptor_buffers = false;
+            }
+            // Only the instanced mode has a bindless variant, and only that pipeline asks for the heap
+            if (toggle_bindless && !next_shaders && shaders->ready()) {
+                if (!device.bindless_supported) {
+                    fprintf(stderr, "Descriptor indexing isn't supported\n");
+                } else if (device.use_descriptor_buffers) {
+                    fprintf(stderr, "The bindless heap doesn't work with descriptor buffers\n");
+                } else {
+                    use_bindless = !use_bindless;
+                    reload_shaders = true;
+                }
+                toggle_bindless = false;
+            }
             if (reload_shaders) {
-                swapchain.drain();
-                shaders = std::make_unique<Shaders>(device);
+                next_shaders = std::make_unique<Shaders>(device);
                 reload_shaders = false;
             }
+            if (next_shaders && next_shaders->ready()) {
+                try {
+                    next_shaders->check();
+                    imr::keepAliveUntilRetired(context, std::move(shaders));
+                    shaders = std::move(next_shaders);
+                } catch (std::exception& e) {
+                    fprintf(stderr, "Failed to reload the shaders: %s\n", e.what());
+                    next_shaders.reset();
+                }
+            }
 
             auto& image = context.image();
             auto cmdbuf = context.cmdbuf();
@@ -248,25 +384,14 @@ int main(int argc, char** argv) {
             if (!depthBuffer || depthBuffer->size().width != context.image().size().width || depthBuffer->size().height != context.image().size().height) {
                 VkImageUsageFlagBits depthBufferFlags = static_cast<VkImageUsageFlagBits>(VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_STORAGE_BIT);
                 depthBuffer = std::make_unique<imr::Image>(device, VK_IMAGE_TYPE_2D, context.image().size(), VK_FORMAT_R32_SFLOAT, depthBufferFlags);
-
-                vk.cmdPipelineBarrier2KHR(cmdbuf, tmpPtr((VkDependencyInfo) {
-                    .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-                    .dependencyFlags = 0,
-                    .imageMemoryBarrierCount = 1,
-                    .pImageMemoryBarriers = tmpPtr((VkImageMemoryBarrier2) {
-                        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
-                        .srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
-                        .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
-                        .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
-                        .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
-                        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-                        .newLayout = VK_IMAGE_LAYOUT_GENERAL,
-                        .image = depthBuffer->handle(),
-                        .subresourceRange = depthBuffer->whole_image_subresource_range()
-                    })
-                }));
             }
 
+            // The barrier batcher knows where both images come from, and does the layout transition for the new depth buffer
+            imr::BarrierBatcher barriers(device, cmdbuf);
+            barriers.require(image, VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+            barriers.require(*depthBuffer, VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+            barriers.flush();
+
             vk.cmdClearColorImage(cmdbuf, image.handle(), VK_IMAGE_LAYOUT_GENERAL, tmpPtr((VkClearColorValue) {
                 .float32 = { 0.0f, 0.0f, 0.0f, 1.0f },
             }), 1, tmpPtr(image.whole_image_subresource_range()));
@@ -275,21 +400,10 @@ int main(int argc, char** argv) {
                 .float32 = { 1.0f, 0.0f, 0.0f, 0.0f },
             }), 1, tmpPtr(depthBuffer->whole_image_subresource_range()));
 
-            // This barrier ensures that the clear is finished before we run the dispatch.
-            // before: all writes from the "transfer" stage (to which the clear command belongs)
-            // after: all writes from the "compute" stage
-            vk.cmdPipelineBarrier2KHR(cmdbuf, tmpPtr((VkDependencyInfo) {
-                .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-                .dependencyFlags = 0,
-                .memoryBarrierCount = 1,
-                .pMemoryBarriers = tmpPtr((VkMemoryBarrier2) {
-                    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
-                    .srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
-                    .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
-                    .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
-                    .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
-                })
-            }));
+            // The clears have to be done before the dispatches, which read and write both images
+            barriers.require(image, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+            barriers.require(*depthBuffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+            barriers.flush();
 
             auto add_render_barrier = [&]() {
                 vk.cmdPipelineBarrier2KHR(cmdbuf, tmpPtr((VkDependencyInfo) {
@@ -315,9 +429,25 @@ int main(int argc, char** argv) {
             m = m * view_mat;
             m = m * translate_mat4(vec3(-0.5, -0.5f, -0.5f));
 
+            if (print_gpu_stats) {
+                for (auto& stats : profiler.stats())
+                    printf("%s: %.3fms (min %.3fms, max %.3fms, over %zu frames)\n", stats.name.c_str(), stats.average, stats.min, stats.max, stats.samples);
+                // and how the CPU frame times are spread out
+                auto histogram = fps_counter.histogram();
+                for (size_t bucket = 0; bucket < histogram.size(); bucket++) {
+                    if (bucket < imr::FpsCounter::histogram_bounds.size())
+                        printf("frames up to %6.2fms: %u\n", imr::FpsCounter::histogram_bounds[bucket], histogram[bucket]);
+                    else
+                        printf("frames slower:        %u\n", histogram[bucket]);
+                }
+                print_gpu_stats = false;
+            }
+
+            uint32_t wg = shaders->workgroup_size;
+            auto draw_scope = profiler.scope(cmdbuf, shaders->descriptor_buffers ? descriptor_buffer_mode_names[mode] : shaders->bindless && mode == INSTANCED ? "instanced, bindless" : mode_names[mode]);
             switch (mode) {
                 case SINGLE: {
-                    auto& shader = shaders->single;
+                    auto& shader = *shaders->single;
                     vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, shader.pipeline());
                     auto shader_bind_helper = shader.create_bind_helper();
                     shader_bind_helper->set_storage_image(0, 0, image);
@@ -341,7 +471,7 @@ int main(int argc, char** argv) {
                             vkCmdPushConstants(cmdbuf, shader.layout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants_single), &push_constants_single);
 
                             // dispatch like before
-                            vkCmdDispatch(cmdbuf, (image.size().width + 31) / 32, (image.size().height + 31) / 32, 1);
+                            vkCmdDispatch(cmdbuf, (image.size().width + wg - 1) / wg, (image.size().height + wg - 1) / wg, 1);
                         }
                     }
 
@@ -351,7 +481,7 @@ int main(int argc, char** argv) {
                     break;
                 }
                 case BATCHED: {
-                    auto& shader = shaders->batched;
+                    auto& shader = *shaders->batched;
                     vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, shader.pipeline());
                     auto shader_bind_helper = shader.create_bind_helper();
                     shader_bind_helper->set_storage_image(0, 0, image);
@@ -372,17 +502,26 @@ int main(int argc, char** argv) {
                         push_constants_batched.matrix = cube_matrix;
 
                         vkCmdPushConstants(cmdbuf, shader.layout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants_batched), &push_constants_batched);
-                        vkCmdDispatch(cmdbuf, (image.size().width + 31) / 32, (image.size().height + 31) / 32, 1);
+                        vkCmdDispatch(cmdbuf, (image.size().width + wg - 1) / wg, (image.size().height + wg - 1) / wg, 1);
                     }
 
+                    context.addCleanupAction([=]() {
+                        delete shader_bind_helper;
+                    });
                     break;
                 }
                 case INSTANCED: {
-                    auto& shader = shaders->instanced;
+                    auto& shader = *shaders->instanced;
                     vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, shader.pipeline());
                     auto shader_bind_helper = shader.create_bind_helper();
-                    shader_bind_helper->set_storage_image(0, 0, image);
-                    shader_bind_helper->set_storage_image(0, 1, *depthBuffer);
+                    // committing still binds the heap, the images just don't need a set of their own
+                    if (shaders->bindless) {
+                        push_constants_instanced.render_target = image.bindless_index();
+                        push_constants_instanced.depth_buffer = depthBuffer->bindless_index();
+                    } else {
+                        shader_bind_helper->set_storage_image(0, 0, image);
+                        shader_bind_helper->set_storage_image(0, 1, *depthBuffer);
+                    }
                     shader_bind_helper->commit(cmdbuf);
 
                     push_constants_instanced.time = ((imr_get_time_nano() / 1000) % 10000000000) / 1000000.0f;
@@ -396,19 +535,26 @@ int main(int argc, char** argv) {
                         cube_matrix = cube_matrix * translate_mat4(pos);
                         matrices.push_back(cube_matrix);
                     }
-                    matrices_buffer->uploadDataSync(0, sizeof(mat4) * matrices.size(), matrices.data());
+                    matrices_buffer->uploadDataAsync(cmdbuf, 0, sizeof(mat4) * matrices.size(), matrices.data());
+                    barriers.require(*matrices_buffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+                    barriers.flush();
 
                     push_constants_instanced.matrices_buffer = matrices_buffer->device_address();
                     push_constants_instanced.instances_count = matrices.size();
 
                     add_render_barrier();
 
-                    vkCmdPushConstants(cmdbuf, shader.layout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants_instanced), &push_constants_instanced);
-                    vkCmdDispatch(cmdbuf, (image.size().width + 31) / 32, (image.size().height + 31) / 32, 1);
+                    uint32_t push_constants_size = shaders->bindless ? sizeof(push_constants_instanced) : offsetof(decltype(push_constants_instanced), render_target);
+                    vkCmdPushConstants(cmdbuf, shader.layout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, push_constants_size, &push_constants_instanced);
+                    vkCmdDispatch(cmdbuf, (image.size().width + wg - 1) / wg, (image.size().height + wg - 1) / wg, 1);
+
+                    context.addCleanupAction([=]() {
+                        delete shader_bind_helper;
+                    });
                     break;
                 }
                 case PIPELINED: {
-                    auto& triangle_transform_shader = shaders->pipelined_triangles;
+                    auto& triangle_transform_shader = *shaders->pipelined_triangles;
                     vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, triangle_transform_shader.pipeline());
 
                     push_constants_pipelined_vert.time = ((imr_get_time_nano() / 1000) % 10000000000) / 1000000.0f;
@@ -422,7 +568,9 @@ int main(int argc, char** argv) {
                         cube_matrix = cube_matrix * translate_mat4(pos);
                         matrices.push_back(cube_matrix);
                     }
-                    matrices_buffer->uploadDataSync(0, sizeof(mat4) * matrices.size(), matrices.data());
+                    matrices_buffer->uploadDataAsync(cmdbuf, 0, sizeof(mat4) * matrices.size(), matrices.data());
+                    barriers.require(*matrices_buffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+                    barriers.flush();
 
                     push_constants_pipelined_vert.matrices_buffer = matrices_buffer->device_address();
                     push_constants_pipelined_vert.instances_count = matrices.size();
@@ -430,12 +578,15 @@ int main(int argc, char** argv) {
 
                     add_render_barrier();
 
-                    vkCmdPushConstants(cmdbuf, triangle_transform_shader.layout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants_pipelined_vert), &push_constants_pipelined_vert);
-                    vkCmdDispatch(cmdbuf, (12 + 31) / 32, (INSTANCES_COUNT + 31) / 32, 1);
+                    {
+                        auto scope = profiler.scope(cmdbuf, "pipelined: triangles");
+                        vkCmdPushConstants(cmdbuf, triangle_transform_shader.layout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants_pipelined_vert), &push_constants_pipelined_vert);
+                        vkCmdDispatch(cmdbuf, (12 + wg - 1) / wg, (INSTANCES_COUNT + wg - 1) / wg, 1);
+                    }
 
                     add_render_barrier();
 
-                    auto& rasterizer_shader = shaders->pipelined_raster;
+                    auto& rasterizer_shader = *shaders->pipelined_raster;
                     vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, rasterizer_shader.pipeline());
                     auto shader_bind_helper = rasterizer_shader.create_bind_helper();
                     shader_bind_helper->set_storage_image(0, 0, image);
@@ -445,9 +596,15 @@ int main(int argc, char** argv) {
                     push_constants_pipelined_frag.preprocessed_tri_buffer = tmp_buffer->device_address();
                     push_constants_pipelined_frag.tri_count = INSTANCES_COUNT * 12;
 
-                    vkCmdPushConstants(cmdbuf, rasterizer_shader.layout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants_pipelined_frag), &push_constants_pipelined_frag);
+                    {
+                        auto scope = profiler.scope(cmdbuf, "pipelined: raster");
+                        vkCmdPushConstants(cmdbuf, rasterizer_shader.layout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants_pipelined_frag), &push_constants_pipelined_frag);
+                        vkCmdDispatch(cmdbuf, (image.size().width + wg - 1) / wg, (image.size().height + wg - 1) / wg, 1);
+                    }
 
-                    vkCmdDispatch(cmdbuf, (image.size().width + 31) / 32, (image.size().height + 31) / 32, 1);
+                    context.addCleanupAction([=]() {
+                        delete shader_bind_helper;
+                    });
                     break;
                 }
             }
@@ -461,5 +618,14 @@ int main(int argc, char** argv) {
     }
 
     swapchain.drain();
+
+    if (frametimes_csv) {
+        if (FILE* file = fopen(frametimes_csv, "w")) {
+            fps_counter.dumpCsv(file);
+            fclose(file);
+        }
+    }
+    if (tracer && !tracer->writeJson(trace_json))
+        fprintf(stderr, "Failed to write the trace to %s\n", trace_json);
     return 0;
 }
@@ -3,13 +3,25 @@
 #extension GL_EXT_scalar_block_layout : require
 #extension GL_EXT_buffer_reference : require
 
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+
+// the images come from the device's BindlessHeap, the push constants say which ones
+layout(set = 3, binding = 0)
+uniform image2D storage_images[];
+
+#define renderTarget storage_images[push_constants.render_target]
+#define depthBuffer storage_images[push_constants.depth_buffer]
+#else
 layout(set = 0, binding = 0)
 uniform image2D renderTarget;
 
 layout(set = 0, binding = 1)
 uniform image2D depthBuffer;
+#endif
 
-layout(local_size_x = 32, local_size_y = 32, local_size_z = 1) in;
+// the workgroup size is picked by the host, see Shaders in 15_compute_cubes.cpp
+layout(local_size_x_id = 0, local_size_y_id = 1, local_size_z = 1) in;
 
 struct Tri { vec3 v0, v1, v2; vec3 color; };
 
@@ -18,11 +30,11 @@ struct Tri { vec3 v0, v1, v2; vec3 color; };
 #define double float
 
 layout(scalar, buffer_reference) buffer TrianglesBuffer {
-    Tri triangles[12];
+    Tri triangles[];
 };
 
 layout(scalar, buffer_reference) buffer MatricesBuffer {
-    mat4 matrices[16];
+    mat4 matrices[];
 };
 
 layout(scalar, push_constant) uniform T {
@@ -31,6 +43,10 @@ layout(scalar, push_constant) uniform T {
     MatricesBuffer matrices_buffer;
     uint matrices_count;
 	float time;
+#ifdef BINDLESS
+    uint render_target;
+    uint depth_buffer;
+#endif
 } push_constants;
 
 double cross_2(dvec2 a, dvec2 b) {
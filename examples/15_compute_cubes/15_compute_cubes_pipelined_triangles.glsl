@@ -3,16 +3,17 @@
 #extension GL_EXT_scalar_block_layout : require
 #extension GL_EXT_buffer_reference : require
 
-layout(local_size_x = 32, local_size_y = 32, local_size_z = 1) in;
+// the workgroup size is picked by the host, see Shaders in 15_compute_cubes.cpp
+layout(local_size_x_id = 0, local_size_y_id = 1, local_size_z = 1) in;
 
 struct Tri { vec3 v0, v1, v2; vec3 color; };
 
 layout(scalar, buffer_reference) buffer TrianglesBuffer {
-    Tri triangles[12];
+    Tri triangles[];
 };
 
 layout(scalar, buffer_reference) buffer MatricesBuffer {
-    mat4 matrices[16];
+    mat4 matrices[];
 };
 
 struct PreprocessedTri {
@@ -26,7 +27,7 @@ struct PreprocessedTri {
 };
 
 layout(scalar, buffer_reference) buffer PreprocessedTrianglesBuffer {
-    PreprocessedTri triangles[192];
+    PreprocessedTri triangles[];
 };
 
 layout(scalar, push_constant) uniform T {
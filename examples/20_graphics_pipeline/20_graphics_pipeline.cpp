@@ -102,10 +102,10 @@ struct Shaders {
     std::vector<std::unique_ptr<imr::ShaderEntryPoint>> entry_points;
     std::unique_ptr<imr::GraphicsPipeline> pipeline;
 
-    Shaders(imr::Device& d, imr::Swapchain& swapchain) {
+    Shaders(imr::Device& d, VkFormat color_format) {
         imr::GraphicsPipeline::RenderTargetsState rts;
         rts.color.push_back((imr::GraphicsPipeline::RenderTarget) {
-            .format = swapchain.format(),
+            .format = color_format,
             .blending = {
                 .blendEnable = false,
                 .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT
@@ -156,6 +156,7 @@ int main(int argc, char** argv) {
     imr::Device device(context);
     imr::Swapchain swapchain(device, window);
     imr::FpsCounter fps_counter;
+    imr::UploadEngine uploads(device);
 
     auto cube = make_cube();
 
@@ -176,7 +177,8 @@ int main(int argc, char** argv) {
             vertex_vector.push_back(tri.color);
         }
         push_constants_batched.vertex_buffer = vertex_buffer->device_address();
-        vertex_buffer->uploadDataSync(0, vertex_buffer->size, vertex_vector.data());
+        // This goes through the transfer queue if there is one, the first frame will wait for it
+        uploads.uploadBuffer(*vertex_buffer, 0, vertex_buffer->size, vertex_vector.data());
     }
 
     std::vector<vec3> positions;
@@ -195,7 +197,15 @@ int main(int argc, char** argv) {
 
     std::unique_ptr<imr::Image> depthBuffer;
 
-    auto shaders = std::make_unique<Shaders>(device, swapchain);
+    // Everything, from loading the SPIR-V to building the pipeline, happens on a compile thread
+    // The swapchain isn't safe to look at from there, so the format it has when the build is kicked off is what the pipeline gets.
+    auto build_shaders = [&]() {
+        VkFormat format = swapchain.format();
+        return device.compileAsync<Shaders>([&device, format]() { return std::make_unique<Shaders>(device, format); });
+    };
+    auto shaders = build_shaders().take();
+    // we keep rendering with the current shaders until the new ones are ready
+    imr::AsyncPipeline<Shaders> next_shaders;
 
     auto& vk = device.dispatch;
     while (!glfwWindowShouldClose(window)) {
@@ -207,14 +217,21 @@ int main(int argc, char** argv) {
             camera_move_freelook(&camera, &camera_input, &camera_state, delta);
 
             if (reload_shaders) {
-                swapchain.drain();
-                shaders = std::make_unique<Shaders>(device, swapchain);
+                next_shaders = build_shaders();
                 reload_shaders = false;
             }
+            try {
+                next_shaders.replace(shaders, context);
+            } catch (std::exception& e) {
+                fprintf(stderr, "Failed to reload the shaders: %s\n", e.what());
+            }
 
             auto& image = context.image();
             auto cmdbuf = context.cmdbuf();
 
+            // Makes sure the uploads are done before we use them, this does nothing once they are
+            uploads.acquire(context.frame(), cmdbuf);
+
             if (!depthBuffer || depthBuffer->size().width != context.image().size().width || depthBuffer->size().height != context.image().size().height) {
                 VkImageUsageFlagBits depthBufferFlags = static_cast<VkImageUsageFlagBits>(VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
                 depthBuffer = std::make_unique<imr::Image>(device, VK_IMAGE_TYPE_2D, context.image().size(), VK_FORMAT_D32_SFLOAT, depthBufferFlags);
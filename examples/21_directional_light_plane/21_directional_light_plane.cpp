@@ -152,7 +152,9 @@ int main() {
     imr::Swapchain swapchain(device, window);
     imr::FpsCounter fps_counter;
     std::unique_ptr<imr::ComputePipeline> shader;
-    shader = std::make_unique<imr::ComputePipeline>(device, "21_directional_light_plane.spv");
+    shader = std::make_unique<imr::ComputePipeline>(device, "21_directional_light_plane.spv", "main", imr::SpecializationConstants {}, imr::PipelineOptions { .push_descriptors = true });
+    // rebuilt in the background, we keep using the current shader until it's ready
+    imr::AsyncPipeline<imr::ComputePipeline> next_shader;
 
     auto cube = make_cube();
     auto plane = make_plane();
@@ -178,10 +180,16 @@ int main() {
             camera_move_freelook(&camera, &camera_input, &camera_state, delta);
 
             if (reload_shaders) {
-                swapchain.drain();
-                shader = std::make_unique<imr::ComputePipeline>(device, "21_directional_light_plane.spv");
+                next_shader = device.compileAsync<imr::ComputePipeline>([&]() {
+                    return std::make_unique<imr::ComputePipeline>(device, "21_directional_light_plane.spv", "main", imr::SpecializationConstants {}, imr::PipelineOptions { .push_descriptors = true });
+                });
                 reload_shaders = false;
             }
+            try {
+                next_shader.replace(shader, context);
+            } catch (std::exception& e) {
+                fprintf(stderr, "Failed to reload the shader: %s\n", e.what());
+            }
 
             auto& image = context.image();
             auto cmdbuf = context.cmdbuf();
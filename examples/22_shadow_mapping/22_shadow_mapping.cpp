@@ -233,6 +233,8 @@ CameraFreelookState camera_state = {
 CameraInput camera_input;
 
 bool reload_shaders = false;
+// Toggled with G, to compare the hand-written frame with the render graph one
+bool use_render_graph = false;
 
 // Light control variables
 float light_azimuth = 45.0f;    // Azimuthal angle in degrees (0-360)
@@ -318,6 +320,8 @@ int main() {
     glfwSetKeyCallback(window, [](GLFWwindow* window, int key, int scancode, int action, int mods) {
         if (key == GLFW_KEY_R && (mods & GLFW_MOD_CONTROL))
             reload_shaders = true;
+        if (key == GLFW_KEY_G && action == GLFW_PRESS)
+            use_render_graph = !use_render_graph;
             
         // Light control keys
         if (action == GLFW_PRESS || action == GLFW_REPEAT) {
@@ -362,8 +366,15 @@ int main() {
     imr::Device device(context);
     imr::Swapchain swapchain(device, window);
     imr::FpsCounter fps_counter;
+    // Each pass gets a scope per mode, "hand-written: ..." or "render graph: ...", which are printed along with the frame times
+    imr::GpuProfiler profiler(swapchain);
+    // Frame times of the current G mode only, started over on every switch so the two don't mix
+    auto mode_frametimes = std::make_unique<imr::FpsCounter>();
+    bool measured_render_graph = use_render_graph;
     std::unique_ptr<imr::ComputePipeline> shader;
-    shader = std::make_unique<imr::ComputePipeline>(device, "22_shadow_mapping.spv");
+    shader = std::make_unique<imr::ComputePipeline>(device, "22_shadow_mapping.spv", "main", imr::SpecializationConstants {}, imr::PipelineOptions { .push_descriptors = true });
+    // rebuilt in the background, we keep using the current shader until it's ready
+    imr::AsyncPipeline<imr::ComputePipeline> next_shader;
 
     auto cube = make_cube();
     auto plane = make_plane();
@@ -379,25 +390,196 @@ int main() {
     std::unique_ptr<imr::Image> shadowMap;
     const int SHADOW_MAP_SIZE = 1024;
 
+    // The GPU times are averages over the last frames the profiler kept, which are all of the mode measured since the switch
+    auto report_mode = [&]() {
+        const char* mode_name = measured_render_graph ? "render graph" : "hand-written";
+        auto frametimes = mode_frametimes->percentiles();
+        printf("%s: p50 %.3fms, p95 %.3fms, p99 %.3fms, 1%% low %.1f fps\n", mode_name,
+               frametimes.p50 * 1000.0f, frametimes.p95 * 1000.0f, frametimes.p99 * 1000.0f, frametimes.one_percent_low_fps);
+        std::string prefix = std::string(mode_name) + ": ";
+        for (auto& stats : profiler.stats()) {
+            if (stats.name.rfind(prefix, 0) == 0)
+                printf("    GPU %s: average %.3fms, min %.3fms, max %.3fms\n", stats.name.c_str() + prefix.size(), stats.average, stats.min, stats.max);
+        }
+    };
+
     auto& vk = device.dispatch;
     while (!glfwWindowShouldClose(window)) {
         fps_counter.tick();
+        if (use_render_graph != measured_render_graph) {
+            report_mode();
+            mode_frametimes = std::make_unique<imr::FpsCounter>();
+            measured_render_graph = use_render_graph;
+        }
+        mode_frametimes->tick();
         
         // Update window title with light controls
+        auto frametimes = mode_frametimes->percentiles();
         char title[256];
-        snprintf(title, sizeof(title), "Shadow Mapping - Azimuth: %.1f° Elevation: %.1f° (Arrow keys: angle, Shift+Arrow: fine)", 
-                light_azimuth, light_elevation);
+        snprintf(title, sizeof(title), "Shadow Mapping - Azimuth: %.1f° Elevation: %.1f° (Arrow keys: angle, Shift+Arrow: fine) - Render graph: %s (G), p50: %.3fms, p99: %.3fms",
+                light_azimuth, light_elevation, use_render_graph ? "on" : "off", frametimes.p50 * 1000.0f, frametimes.p99 * 1000.0f);
         glfwSetWindowTitle(window, title);
 
         swapchain.renderFrameSimplified([&](imr::Swapchain::SimplifiedRenderContext& context) {
             camera_update(window, &camera_input);
             camera_move_freelook(&camera, &camera_input, &camera_state, delta);
 
+            auto now = imr_get_time_nano();
+            delta = ((float) ((now - prev_frame) / 1000L)) / 1000000.0f;
+            prev_frame = now;
+
+            glfwPollEvents();
+
             if (reload_shaders) {
-                swapchain.drain();
-                shader = std::make_unique<imr::ComputePipeline>(device, "22_shadow_mapping.spv");
+                next_shader = device.compileAsync<imr::ComputePipeline>([&]() {
+                    return std::make_unique<imr::ComputePipeline>(device, "22_shadow_mapping.spv", "main", imr::SpecializationConstants {}, imr::PipelineOptions { .push_descriptors = true });
+                });
                 reload_shaders = false;
             }
+            try {
+                next_shader.replace(shader, context);
+            } catch (std::exception& e) {
+                fprintf(stderr, "Failed to reload the shader: %s\n", e.what());
+            }
+
+            // Calculate light direction from spherical coordinates
+            vec3 light_direction = -spherical_to_cartesian(light_azimuth, light_elevation);
+
+            // Create light view-projection matrix
+            vec3 scene_center = vec3(0, 0.5, 0);
+            float scene_radius = 8.0f;
+            mat4 light_view_proj = create_light_view_proj_matrix(light_direction, scene_center, scene_radius);
+
+            // Create light ray line from cube center
+            vec3 cube_center = vec3(0, 1, 0); // Cube is lifted 1 unit above plane
+            Line light_ray = make_light_ray_line(cube_center, -light_direction, 10.0f);
+
+            push_constants.time = ((imr_get_time_nano() / 1000) % 10000000000) / 1000000.0f;
+            push_constants.light_direction = light_direction;
+            push_constants.light_view_proj_matrix = light_view_proj;
+            push_constants.apply_shadows = 1; // Enable shadows by default
+
+            // Setup camera matrices for skybox (without translation)
+            mat4 skybox_view = identity_mat4;
+            mat4 flip_y = identity_mat4;
+            flip_y.rows[1][1] = -1;
+            skybox_view = skybox_view * flip_y;
+            
+            // Create view matrix without translation for skybox
+            Camera skybox_camera = camera;
+            skybox_camera.position = vec3(0, 0, 0); // Remove translation
+            mat4 skybox_view_mat = camera_get_view_mat4(&skybox_camera, context.image().size().width, context.image().size().height);
+            skybox_view = skybox_view * skybox_view_mat;
+
+            // Setup transformation matrices for main scene
+            mat4 m = identity_mat4;
+            m = m * flip_y;
+            mat4 view_mat = camera_get_view_mat4(&camera, context.image().size().width, context.image().size().height);
+            m = m * view_mat;
+
+            // The same frame as below, described as a render graph: it works out the barriers and the async compute submission,
+            // and the depth buffer and shadow map are transient images, which it allocates for us
+            if (use_render_graph) {
+                imr::RenderGraph graph(context);
+                VkExtent3D size = context.image().size();
+                auto target = graph.importImage(context.image());
+                auto depth = graph.createImage(VK_IMAGE_TYPE_2D, size, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_STORAGE_BIT);
+                auto shadow = graph.createImage(VK_IMAGE_TYPE_2D, { SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 1 }, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_STORAGE_BIT);
+
+                // the transient images only exist once the passes are recorded
+                imr::DescriptorBindHelper* bind_helper = nullptr;
+                auto bind_shader = [&](imr::RenderGraph::PassContext& pass) {
+                    if (!bind_helper) {
+                        bind_helper = shader->create_bind_helper();
+                        bind_helper->set_storage_image(0, 0, pass.image(target));
+                        bind_helper->set_storage_image(0, 1, pass.image(depth));
+                        bind_helper->set_storage_image(0, 2, pass.image(shadow));
+                        context.addCleanupAction([bind_helper]() {
+                            delete bind_helper;
+                        });
+                    }
+                    vkCmdBindPipeline(pass.cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, shader->pipeline());
+                    bind_helper->commit(pass.cmdbuf);
+                };
+                auto draw = [&](imr::RenderGraph::PassContext& pass, Tri& tri, mat4 matrix, VkExtent3D extent) {
+                    push_constants.tri = tri;
+                    push_constants.matrix = matrix;
+                    vkCmdPushConstants(pass.cmdbuf, shader->layout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+                    vkCmdDispatch(pass.cmdbuf, (extent.width + 31) / 32, (extent.height + 31) / 32, 1);
+                };
+                auto clear = [&](imr::RenderGraph::PassContext& pass, imr::RenderGraph::ImageId id, VkClearColorValue value) {
+                    auto& image = pass.image(id);
+                    vk.cmdClearColorImage(pass.cmdbuf, image.handle(), VK_IMAGE_LAYOUT_GENERAL, &value, 1, tmpPtr(image.whole_image_subresource_range()));
+                };
+
+                graph.addPass("clear", imr::RenderGraph::Queue::MAIN, [&](imr::RenderGraph::PassContext& pass) {
+                    auto scope = profiler.scope(pass.cmdbuf, "render graph: clear");
+                    clear(pass, target, { .float32 = { 0.1f, 0.1f, 0.2f, 1.0f } });
+                    clear(pass, depth, { .float32 = { 1.0f, 0.0f, 0.0f, 0.0f } });
+                })
+                    .use(target, VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT)
+                    .use(depth, VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+
+                graph.addPass("skybox", imr::RenderGraph::Queue::MAIN, [&](imr::RenderGraph::PassContext& pass) {
+                    auto scope = profiler.scope(pass.cmdbuf, "render graph: skybox");
+                    bind_shader(pass);
+                    push_constants.render_mode = 2;
+                    for (int i = 0; i < 12; i++) {
+                        if (i > 0)
+                            pass.barrier();
+                        Tri skybox_tri = { skybox.triangles[i].v0, skybox.triangles[i].v1, skybox.triangles[i].v2, vec3(1.0, 1.0, 1.0), vec3(0, 0, 1) };
+                        draw(pass, skybox_tri, skybox_view, size);
+                    }
+                })
+                    .readWrite(target)
+                    .readWrite(depth);
+
+                graph.addPass("shadow map", imr::RenderGraph::Queue::ASYNC_COMPUTE, [&](imr::RenderGraph::PassContext& pass) {
+                    auto scope = profiler.scope(pass.cmdbuf, "render graph: shadow map");
+                    clear(pass, shadow, { .float32 = { 1.0f, 0.0f, 0.0f, 0.0f } });
+                    pass.barrier();
+                    bind_shader(pass);
+                    push_constants.render_mode = 0;
+                    VkExtent3D extent = { SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 1 };
+                    for (int i = 0; i < 2; i++) {
+                        if (i > 0)
+                            pass.barrier();
+                        draw(pass, plane.triangles[i], light_view_proj, extent);
+                    }
+                    mat4 cube_light_matrix = light_view_proj * translate_mat4(vec3(0, 1, 0)) * translate_mat4(vec3(-0.5, -0.5, -0.5));
+                    for (int i = 0; i < 12; i++) {
+                        pass.barrier();
+                        draw(pass, cube.triangles[i], cube_light_matrix, extent);
+                    }
+                })
+                    .use(shadow, VK_PIPELINE_STAGE_2_CLEAR_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+                graph.addPass("scene", imr::RenderGraph::Queue::MAIN, [&](imr::RenderGraph::PassContext& pass) {
+                    auto scope = profiler.scope(pass.cmdbuf, "render graph: scene");
+                    bind_shader(pass);
+                    push_constants.render_mode = 1;
+                    mat4 cube_matrix = m * translate_mat4(vec3(0, 1, 0)) * translate_mat4(vec3(-0.5, -0.5, -0.5));
+                    for (int i = 0; i < 2; i++) {
+                        if (i > 0)
+                            pass.barrier();
+                        draw(pass, plane.triangles[i], m, size);
+                    }
+                    for (int i = 0; i < 12; i++) {
+                        pass.barrier();
+                        draw(pass, cube.triangles[i], cube_matrix, size);
+                    }
+                    for (int i = 0; i < 2; i++) {
+                        pass.barrier();
+                        draw(pass, light_ray.triangles[i], m, size);
+                    }
+                })
+                    .readWrite(target)
+                    .readWrite(depth)
+                    .read(shadow);
+
+                graph.execute();
+                return;
+            }
 
             auto& image = context.image();
             auto cmdbuf = context.cmdbuf();
@@ -425,66 +607,54 @@ int main() {
                 }));
             }
 
-            // Create shadow map if needed
+            // Create shadow map if needed, it's written on the async compute queue which also takes care of its layout
             if (!shadowMap) {
                 VkImageUsageFlagBits shadowMapFlags = static_cast<VkImageUsageFlagBits>(VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_STORAGE_BIT);
                 shadowMap = std::make_unique<imr::Image>(device, VK_IMAGE_TYPE_2D, 
                     VkExtent3D{SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 1}, VK_FORMAT_R32_SFLOAT, shadowMapFlags);
+            }
 
+            // Clear main render target and depth buffer
+            {
+                auto scope = profiler.scope(cmdbuf, "hand-written: clear");
+                vk.cmdClearColorImage(cmdbuf, image.handle(), VK_IMAGE_LAYOUT_GENERAL, tmpPtr((VkClearColorValue) {
+                    .float32 = { 0.1f, 0.1f, 0.2f, 1.0f }, // Dark blue background
+                }), 1, tmpPtr(image.whole_image_subresource_range()));
+
+                vk.cmdClearColorImage(cmdbuf, depthBuffer->handle(), VK_IMAGE_LAYOUT_GENERAL, tmpPtr((VkClearColorValue) {
+                    .float32 = { 1.0f, 0.0f, 0.0f, 0.0f },
+                }), 1, tmpPtr(depthBuffer->whole_image_subresource_range()));
+            }
+
+            // Barrier to ensure clear is finished
+            auto add_clear_barrier = [&](VkCommandBuffer cmdbuf) {
                 vk.cmdPipelineBarrier2KHR(cmdbuf, tmpPtr((VkDependencyInfo) {
                     .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
                     .dependencyFlags = 0,
-                    .imageMemoryBarrierCount = 1,
-                    .pImageMemoryBarriers = tmpPtr((VkImageMemoryBarrier2) {
-                        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                    .memoryBarrierCount = 1,
+                    .pMemoryBarriers = tmpPtr((VkMemoryBarrier2) {
+                        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
                         .srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
                         .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
                         .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
                         .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
-                        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-                        .newLayout = VK_IMAGE_LAYOUT_GENERAL,
-                        .image = shadowMap->handle(),
-                        .subresourceRange = shadowMap->whole_image_subresource_range()
                     })
                 }));
-            }
-
-            // Clear main render target and depth buffer
-            vk.cmdClearColorImage(cmdbuf, image.handle(), VK_IMAGE_LAYOUT_GENERAL, tmpPtr((VkClearColorValue) {
-                .float32 = { 0.1f, 0.1f, 0.2f, 1.0f }, // Dark blue background
-            }), 1, tmpPtr(image.whole_image_subresource_range()));
-
-            vk.cmdClearColorImage(cmdbuf, depthBuffer->handle(), VK_IMAGE_LAYOUT_GENERAL, tmpPtr((VkClearColorValue) {
-                .float32 = { 1.0f, 0.0f, 0.0f, 0.0f },
-            }), 1, tmpPtr(depthBuffer->whole_image_subresource_range()));
-
-            // Clear shadow map
-            vk.cmdClearColorImage(cmdbuf, shadowMap->handle(), VK_IMAGE_LAYOUT_GENERAL, tmpPtr((VkClearColorValue) {
-                .float32 = { 1.0f, 0.0f, 0.0f, 0.0f },
-            }), 1, tmpPtr(shadowMap->whole_image_subresource_range()));
-
-            // Barrier to ensure clear is finished
-            vk.cmdPipelineBarrier2KHR(cmdbuf, tmpPtr((VkDependencyInfo) {
-                .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-                .dependencyFlags = 0,
-                .memoryBarrierCount = 1,
-                .pMemoryBarriers = tmpPtr((VkMemoryBarrier2) {
-                    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
-                    .srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
-                    .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
-                    .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
-                    .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
-                })
-            }));
+            };
+            add_clear_barrier(cmdbuf);
 
-            vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, shader->pipeline());
             auto shader_bind_helper = shader->create_bind_helper();
             shader_bind_helper->set_storage_image(0, 0, image);
             shader_bind_helper->set_storage_image(0, 1, *depthBuffer);
             shader_bind_helper->set_storage_image(0, 2, *shadowMap);
-            shader_bind_helper->commit(cmdbuf);
+            // New command buffers start without any state bound
+            auto bind_shader = [&](VkCommandBuffer cmdbuf) {
+                vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, shader->pipeline());
+                shader_bind_helper->commit(cmdbuf);
+            };
+            bind_shader(cmdbuf);
 
-            auto add_render_barrier = [&]() {
+            auto add_render_barrier_to = [&](VkCommandBuffer cmdbuf) {
                 vk.cmdPipelineBarrier2KHR(cmdbuf, tmpPtr((VkDependencyInfo) {
                    .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
                    .dependencyFlags = 0,
@@ -498,98 +668,80 @@ int main() {
                    })
                }));
             };
+            auto add_render_barrier = [&]() { add_render_barrier_to(cmdbuf); };
 
-            // Calculate light direction from spherical coordinates
-            vec3 light_direction = -spherical_to_cartesian(light_azimuth, light_elevation);
-
-            // Create light view-projection matrix
-            vec3 scene_center = vec3(0, 0.5, 0);
-            float scene_radius = 8.0f;
-            mat4 light_view_proj = create_light_view_proj_matrix(light_direction, scene_center, scene_radius);
+            // PASS 1: Render skybox, it doesn't need the shadow map so it can run while the shadow map is generated
+            push_constants.render_mode = 2; // Skybox mode
 
-            // Create light ray line from cube center
-            vec3 cube_center = vec3(0, 1, 0); // Cube is lifted 1 unit above plane
-            Line light_ray = make_light_ray_line(cube_center, -light_direction, 10.0f);
+            {
+                auto scope = profiler.scope(cmdbuf, "hand-written: skybox");
+                for (int i = 0; i < 12; i++) {
+                    add_render_barrier();
+
+                    // Convert skybox triangle to regular triangle for rendering
+                    Tri skybox_tri = {
+                        skybox.triangles[i].v0,
+                        skybox.triangles[i].v1,
+                        skybox.triangles[i].v2,
+                        vec3(1.0, 1.0, 1.0), // White color
+                        vec3(0, 0, 1) // Dummy normal for skybox
+                    };
+                    push_constants.tri = skybox_tri;
+                    push_constants.matrix = skybox_view;
+
+                    vkCmdPushConstants(cmdbuf, shader->layout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+                    vkCmdDispatch(cmdbuf, (image.size().width + 31) / 32, (image.size().height + 31) / 32, 1);
+                }
+            }
 
-            push_constants.time = ((imr_get_time_nano() / 1000) % 10000000000) / 1000000.0f;
-            push_constants.light_direction = light_direction;
-            push_constants.light_view_proj_matrix = light_view_proj;
-            push_constants.apply_shadows = 1; // Enable shadows by default
+            // Send the skybox off now, so it doesn't wait for the shadow map like the rest of the frame
+            context.flush();
+            cmdbuf = context.cmdbuf();
+            bind_shader(cmdbuf);
 
-            // PASS 1: Generate shadow map from light's perspective
+            // PASS 2: Generate shadow map from light's perspective, on the async compute queue
             push_constants.render_mode = 0; // Shadow map mode
+            context.frame().submitAsyncCompute([&](VkCommandBuffer compute_cmdbuf) {
+                auto scope = profiler.scope(compute_cmdbuf, "hand-written: shadow map");
+                vk.cmdClearColorImage(compute_cmdbuf, shadowMap->handle(), VK_IMAGE_LAYOUT_GENERAL, tmpPtr((VkClearColorValue) {
+                    .float32 = { 1.0f, 0.0f, 0.0f, 0.0f },
+                }), 1, tmpPtr(shadowMap->whole_image_subresource_range()));
+                add_clear_barrier(compute_cmdbuf);
+                bind_shader(compute_cmdbuf);
 
-            // Render plane triangles to shadow map
-            for (int i = 0; i < 2; i++) {
-                add_render_barrier();
+                // Render plane triangles to shadow map
+                for (int i = 0; i < 2; i++) {
+                    add_render_barrier_to(compute_cmdbuf);
 
-                push_constants.tri = plane.triangles[i];
-                push_constants.matrix = light_view_proj;
+                    push_constants.tri = plane.triangles[i];
+                    push_constants.matrix = light_view_proj;
 
-                vkCmdPushConstants(cmdbuf, shader->layout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
-                vkCmdDispatch(cmdbuf, (SHADOW_MAP_SIZE + 31) / 32, (SHADOW_MAP_SIZE + 31) / 32, 1);
-            }
+                    vkCmdPushConstants(compute_cmdbuf, shader->layout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+                    vkCmdDispatch(compute_cmdbuf, (SHADOW_MAP_SIZE + 31) / 32, (SHADOW_MAP_SIZE + 31) / 32, 1);
+                }
 
-            // Render cube triangles to shadow map
-            mat4 cube_light_matrix = light_view_proj;
-            cube_light_matrix = cube_light_matrix * translate_mat4(vec3(0, 1, 0)); // Lift cube 1 unit above plane
-            cube_light_matrix = cube_light_matrix * translate_mat4(vec3(-0.5, -0.5, -0.5)); // Center cube
+                // Render cube triangles to shadow map
+                mat4 cube_light_matrix = light_view_proj;
+                cube_light_matrix = cube_light_matrix * translate_mat4(vec3(0, 1, 0)); // Lift cube 1 unit above plane
+                cube_light_matrix = cube_light_matrix * translate_mat4(vec3(-0.5, -0.5, -0.5)); // Center cube
 
-            for (int i = 0; i < 12; i++) {
-                add_render_barrier();
+                for (int i = 0; i < 12; i++) {
+                    add_render_barrier_to(compute_cmdbuf);
 
-                push_constants.tri = cube.triangles[i];
-                push_constants.matrix = cube_light_matrix;
+                    push_constants.tri = cube.triangles[i];
+                    push_constants.matrix = cube_light_matrix;
 
-                vkCmdPushConstants(cmdbuf, shader->layout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
-                vkCmdDispatch(cmdbuf, (SHADOW_MAP_SIZE + 31) / 32, (SHADOW_MAP_SIZE + 31) / 32, 1);
-            }
+                    vkCmdPushConstants(compute_cmdbuf, shader->layout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+                    vkCmdDispatch(compute_cmdbuf, (SHADOW_MAP_SIZE + 31) / 32, (SHADOW_MAP_SIZE + 31) / 32, 1);
+                }
+            }, { shadowMap.get() });
 
-            add_render_barrier(); // Ensure shadow map is complete before main render
-
-            // PASS 2: Render skybox
-            push_constants.render_mode = 2; // Skybox mode
-            
-            // Setup camera matrices for skybox (without translation)
-            mat4 skybox_view = identity_mat4;
-            mat4 flip_y = identity_mat4;
-            flip_y.rows[1][1] = -1;
-            skybox_view = skybox_view * flip_y;
-            
-            // Create view matrix without translation for skybox
-            Camera skybox_camera = camera;
-            skybox_camera.position = vec3(0, 0, 0); // Remove translation
-            mat4 skybox_view_mat = camera_get_view_mat4(&skybox_camera, context.image().size().width, context.image().size().height);
-            skybox_view = skybox_view * skybox_view_mat;
-
-            for (int i = 0; i < 12; i++) {
-                add_render_barrier();
-
-                // Convert skybox triangle to regular triangle for rendering
-                Tri skybox_tri = {
-                    skybox.triangles[i].v0,
-                    skybox.triangles[i].v1,
-                    skybox.triangles[i].v2,
-                    vec3(1.0, 1.0, 1.0), // White color
-                    vec3(0, 0, 1) // Dummy normal for skybox
-                };
-                push_constants.tri = skybox_tri;
-                push_constants.matrix = skybox_view;
-
-                vkCmdPushConstants(cmdbuf, shader->layout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
-                vkCmdDispatch(cmdbuf, (image.size().width + 31) / 32, (image.size().height + 31) / 32, 1);
-            }
+            add_render_barrier(); // Ensure the skybox is done before the main render
 
             // PASS 3: Render scene with shadows
             push_constants.render_mode = 1; // Final render mode with shadows
-
-            // Setup transformation matrices for main scene
-            mat4 m = identity_mat4;
-            flip_y = identity_mat4;
-            flip_y.rows[1][1] = -1;
-            m = m * flip_y;
-            mat4 view_mat = camera_get_view_mat4(&camera, context.image().size().width, context.image().size().height);
-            m = m * view_mat;
+            // ends with this lambda, after the last draw
+            auto scene_scope = profiler.scope(cmdbuf, "hand-written: scene");
 
             // Render plane triangles
             mat4 plane_matrix = m;
@@ -632,15 +784,10 @@ int main() {
             context.addCleanupAction([=, &device]() {
                 delete shader_bind_helper;
             });
-
-            auto now = imr_get_time_nano();
-            delta = ((float) ((now - prev_frame) / 1000L)) / 1000000.0f;
-            prev_frame = now;
-
-            glfwPollEvents();
         });
     }
 
     swapchain.drain();
+    report_mode();
     return 0;
 }
@@ -0,0 +1,154 @@
+#include "imr/imr.h"
+#include "imr/util.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+// Compares where a frame's command buffers come from: allocated from Device::pool and freed once the frame retired, like imr used to,
+// or handed out by Frame::allocateCommandBuffer() from the per-frame pools that are reset as a whole.
+// Runs headless, both ways in turn, and prints the CPU time of each frame and of the part that records and submits.
+
+struct Times {
+    std::vector<float> frame;
+    std::vector<float> record;
+};
+
+static void print_times(const char* name, Times& times) {
+    auto print = [](const char* what, std::vector<float>& samples) {
+        std::sort(samples.begin(), samples.end());
+        double total = 0;
+        for (float sample : samples)
+            total += sample;
+        printf("    %s: average %.4fms, p50 %.4fms, p99 %.4fms\n", what, total / samples.size(), samples[samples.size() / 2], samples[std::min(samples.size() - 1, samples.size() * 99 / 100)]);
+    };
+    printf("%s:\n", name);
+    print("frame", times.frame);
+    print("allocate, record and submit", times.record);
+}
+
+int main(int argc, char** argv) {
+    int frames = 2000;
+    // frames at the start of each run that aren't counted, the first ones allocate everything
+    int warmup = 100;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        }
+    }
+
+    imr::Context context;
+    imr::Device device(context);
+    imr::Swapchain swapchain(device, VkExtent2D { 1024, 1024 });
+    auto& vk = device.dispatch;
+
+    VkExtent3D extents = { 1024, 1024, 1 };
+    imr::Image image(device, VK_IMAGE_TYPE_2D, extents, VK_FORMAT_R8G8B8A8_UNORM, (VkImageUsageFlagBits) (VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT));
+
+    auto run = [&](bool pooled) {
+        Times times;
+        uint64_t last_frame = 0;
+        for (int frame_number = 0; frame_number < warmup + frames; frame_number++) {
+            swapchain.beginFrame([&](imr::Swapchain::Frame& frame) {
+                uint64_t begin = imr_get_time_nano();
+
+                VkCommandBuffer cmdbuf;
+                if (pooled) {
+                    cmdbuf = frame.allocateCommandBuffer();
+                } else {
+                    CHECK_VK(vkAllocateCommandBuffers(device.device, tmpPtr((VkCommandBufferAllocateInfo) {
+                        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                        .commandPool = device.pool,
+                        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                        .commandBufferCount = 1,
+                    }), &cmdbuf), throw std::runtime_error("failed to allocate a command buffer"));
+                    frame.addCleanupAction([&device, cmdbuf]() {
+                        vkFreeCommandBuffers(device.device, device.pool, 1, &cmdbuf);
+                    });
+                }
+
+                vkBeginCommandBuffer(cmdbuf, tmpPtr((VkCommandBufferBeginInfo) {
+                    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+                }));
+
+                vk.cmdPipelineBarrier2KHR(cmdbuf, tmpPtr((VkDependencyInfo) {
+                    .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                    .imageMemoryBarrierCount = 1,
+                    .pImageMemoryBarriers = tmpPtr((VkImageMemoryBarrier2) {
+                        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                        .srcStageMask = VK_PIPELINE_STAGE_2_NONE,
+                        .srcAccessMask = VK_ACCESS_2_NONE,
+                        .dstStageMask = VK_PIPELINE_STAGE_2_CLEAR_BIT,
+                        .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                        .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+                        .image = image.handle(),
+                        .subresourceRange = image.whole_image_subresource_range(),
+                    }),
+                }));
+
+                float shade = (frame_number % 256) / 255.0f;
+                vk.cmdClearColorImage(cmdbuf, image.handle(), VK_IMAGE_LAYOUT_GENERAL, tmpPtr((VkClearColorValue) {
+                    .float32 = { shade, 0.0f, 0.0f, 1.0f },
+                }), 1, tmpPtr(image.whole_image_subresource_range()));
+
+                // presentFromImage blits from it next
+                vk.cmdPipelineBarrier2KHR(cmdbuf, tmpPtr((VkDependencyInfo) {
+                    .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                    .imageMemoryBarrierCount = 1,
+                    .pImageMemoryBarriers = tmpPtr((VkImageMemoryBarrier2) {
+                        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                        .srcStageMask = VK_PIPELINE_STAGE_2_CLEAR_BIT,
+                        .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                        .dstStageMask = VK_PIPELINE_STAGE_2_BLIT_BIT,
+                        .dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT,
+                        .oldLayout = VK_IMAGE_LAYOUT_GENERAL,
+                        .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+                        .image = image.handle(),
+                        .subresourceRange = image.whole_image_subresource_range(),
+                    }),
+                }));
+
+                vkEndCommandBuffer(cmdbuf);
+
+                VkSemaphore cleared = device.getSemaphore();
+                vkQueueSubmit(device.main_queue, 1, tmpPtr((VkSubmitInfo) {
+                    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                    .commandBufferCount = 1,
+                    .pCommandBuffers = &cmdbuf,
+                    .signalSemaphoreCount = 1,
+                    .pSignalSemaphores = &cleared,
+                }), VK_NULL_HANDLE);
+
+                uint64_t end = imr_get_time_nano();
+                if (frame_number >= warmup)
+                    times.record.push_back((end - begin) / 1000000.0f);
+
+                VkFence reusable = device.getFence();
+                frame.addCleanupAction([&device, cleared, reusable]() {
+                    device.recycleSemaphore(cleared);
+                    device.recycleFence(reusable);
+                });
+                frame.presentFromImage(image.handle(), reusable, { cleared }, VK_IMAGE_LAYOUT_GENERAL, VkExtent2D { extents.width, extents.height });
+            });
+
+            uint64_t now = imr_get_time_nano();
+            if (frame_number > warmup)
+                times.frame.push_back((now - last_frame) / 1000000.0f);
+            last_frame = now;
+        }
+        swapchain.drain();
+        return times;
+    };
+
+    auto per_frame = run(false);
+    auto pooled = run(true);
+    printf("%d frames each, CPU times\n", frames);
+    print_times("allocated and freed per frame", per_frame);
+    print_times("recycled per-frame pools", pooled);
+
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "imr/imr.h"
+#include "imr/util.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+// Times binding the two storage images of 15_compute_cubes the way it does every draw: a bind helper, set_storage_image() twice and commit().
+// Once with descriptor sets from the pools, once with the set pushed, and once with descriptor buffers if the device has them.
+// Only the CPU side is measured, the command buffers are recorded but never submitted.
+
+/// Helpers per command buffer, about what a frame of the single mode of 15_compute_cubes binds
+static const int helpers_per_round = 256;
+
+static void print_times(const char* name, std::vector<float>& samples) {
+    std::sort(samples.begin(), samples.end());
+    double total = 0;
+    for (float sample : samples)
+        total += sample;
+    printf("%s: average %.2fus, p50 %.2fus, p99 %.2fus\n", name, total / samples.size(), samples[samples.size() / 2], samples[std::min(samples.size() - 1, samples.size() * 99 / 100)]);
+}
+
+int main(int argc, char** argv) {
+    int rounds = 200;
+    // rounds at the start of each run that aren't counted, the first ones create the pools and blocks
+    int warmup = 10;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+            rounds = atoi(argv[++i]);
+        }
+    }
+
+    imr::Context context;
+    imr::Device device(context);
+
+    VkExtent3D extents = { 1024, 1024, 1 };
+    imr::Image render_target(device, VK_IMAGE_TYPE_2D, extents, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_STORAGE_BIT);
+    imr::Image depth_buffer(device, VK_IMAGE_TYPE_2D, extents, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT);
+
+    auto run = [&](bool descriptor_buffers, bool push_descriptors) {
+        device.use_descriptor_buffers = descriptor_buffers;
+        imr::ComputePipeline shader(device, "15_compute_cubes.spv", "main", { { 0, 8u }, { 1, 8u } }, { .push_descriptors = push_descriptors });
+
+        std::vector<float> samples;
+        std::vector<imr::DescriptorBindHelper*> helpers;
+        for (int round = 0; round < warmup + rounds; round++) {
+            VkCommandBuffer cmdbuf;
+            CHECK_VK(vkAllocateCommandBuffers(device.device, tmpPtr((VkCommandBufferAllocateInfo) {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .commandPool = device.pool,
+                .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                .commandBufferCount = 1,
+            }), &cmdbuf), throw std::runtime_error("failed to allocate a command buffer"));
+            vkBeginCommandBuffer(cmdbuf, tmpPtr((VkCommandBufferBeginInfo) {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+            }));
+            vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, shader.pipeline());
+
+            for (int i = 0; i < helpers_per_round; i++) {
+                uint64_t begin = imr_get_time_nano();
+                auto helper = shader.create_bind_helper();
+                helper->set_storage_image(0, 0, render_target);
+                helper->set_storage_image(0, 1, depth_buffer);
+                helper->commit(cmdbuf);
+                uint64_t end = imr_get_time_nano();
+                if (round >= warmup)
+                    samples.push_back((end - begin) / 1000.0f);
+                helpers.push_back(helper);
+            }
+
+            vkEndCommandBuffer(cmdbuf);
+            // nothing was submitted, so the sets and descriptor buffer ranges can go right away
+            for (auto helper : helpers)
+                delete helper;
+            helpers.clear();
+            vkFreeCommandBuffers(device.device, device.pool, 1, &cmdbuf);
+        }
+        device.use_descriptor_buffers = false;
+        return samples;
+    };
+
+    printf("%d binds each, CPU time of a bind helper with both images set and committed\n", rounds * helpers_per_round);
+    auto pooled = run(false, false);
+    print_times("descriptor sets from the pools", pooled);
+    auto pushed = run(false, true);
+    print_times("pushed descriptor set", pushed);
+    if (device.descriptor_buffer_supported) {
+        auto buffers = run(true, false);
+        print_times("descriptor buffers", buffers);
+    } else {
+        printf("descriptor buffers: VK_EXT_descriptor_buffer isn't supported\n");
+    }
+
+    return 0;
+}
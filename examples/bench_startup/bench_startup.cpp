@@ -0,0 +1,78 @@
+#include "imr/imr.h"
+#include "imr/util.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+// Times creating a Device and building the pipelines of 15_compute_cubes, in a few workgroup sizes each,
+// with the pipeline cache file missing (cold) and then with the one that run saved (warm).
+
+static void set_env(const char* name, const char* value) {
+#ifdef _MSC_VER
+    _putenv_s(name, value);
+#else
+    setenv(name, value, 1);
+#endif
+}
+
+static const char* shaders[] = {
+    "15_compute_cubes.spv",
+    "15_compute_cubes_batched.spv",
+    "15_compute_cubes_instanced.spv",
+    "15_compute_cubes_pipelined_triangles.spv",
+    "15_compute_cubes_pipelined_raster.spv",
+};
+
+struct StartupTimes {
+    float device;
+    float pipelines;
+};
+
+/// The Device saves the cache when it goes away, which isn't timed
+static StartupTimes startup(imr::Context& context, const std::string& cache_path) {
+    set_env("IMR_PIPELINE_CACHE", cache_path.c_str());
+
+    uint64_t begin = imr_get_time_nano();
+    imr::Device device(context);
+    uint64_t device_created = imr_get_time_nano();
+
+    auto& limits = device.physical_device.properties.limits;
+    std::vector<std::unique_ptr<imr::ComputePipeline>> pipelines;
+    for (auto shader : shaders) {
+        for (uint32_t size : { 4u, 8u, 16u, 32u }) {
+            if (size * size > limits.maxComputeWorkGroupInvocations || size > limits.maxComputeWorkGroupSize[0] || size > limits.maxComputeWorkGroupSize[1])
+                continue;
+            pipelines.push_back(std::make_unique<imr::ComputePipeline>(device, shader, "main", imr::SpecializationConstants { { 0, size }, { 1, size } }));
+        }
+    }
+    uint64_t end = imr_get_time_nano();
+
+    return { (device_created - begin) / 1000000.0f, (end - device_created) / 1000000.0f };
+}
+
+int main() {
+    // Drivers keep shader caches of their own, which would make the cold run warm. These are Mesa's and NVIDIA's.
+    set_env("MESA_SHADER_CACHE_DISABLE", "true");
+    set_env("__GL_SHADER_DISK_CACHE", "0");
+
+    auto dir = std::filesystem::temp_directory_path();
+    auto priming_path = (dir / "imr_bench_startup_priming.bin").string();
+    auto cache_path = (dir / "imr_bench_startup.bin").string();
+    std::filesystem::remove(priming_path);
+    std::filesystem::remove(cache_path);
+
+    imr::Context context;
+    // The reflected layouts are cached for the whole process, this gets them in there so both runs below find them
+    startup(context, priming_path);
+
+    auto cold = startup(context, cache_path);
+    auto warm = startup(context, cache_path);
+    printf("cold: device %.2fms, pipelines %.2fms\n", cold.device, cold.pipelines);
+    printf("warm: device %.2fms, pipelines %.2fms (cache file: %zu bytes)\n", warm.device, warm.pipelines, (size_t) std::filesystem::file_size(cache_path));
+
+    std::filesystem::remove(priming_path);
+    std::filesystem::remove(cache_path);
+    return 0;
+}
@@ -12,12 +12,8 @@ int main() {
     imr::Swapchain swapchain(device, window);
     imr::FpsCounter fps_counter;
 
-    // CPU-side staging buffer
-    uint8_t* framebuffer = reinterpret_cast<uint8_t*>(malloc(width * height * 4));
-
+    // Host-visible buffers are mapped for us, so we can write the pixels straight into it
     std::unique_ptr<imr::Buffer> buffer = std::make_unique<imr::Buffer>(device, width * height * 4, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-    uint8_t* mapped_buffer;
-    CHECK_VK(vkMapMemory(device.device, buffer->memory, buffer->memory_offset, buffer->size, 0, (void**) &mapped_buffer), abort());
 
     VkFence fence;
     vkCreateFence(device.device, tmpPtr((VkFenceCreateInfo) {
@@ -31,21 +27,17 @@ int main() {
             int nwidth = frame.image().size().width;
             int nheight = frame.image().size().height;
 
+            // the previous copy out of the buffer has to be done before we touch it
+            vkWaitForFences(device.device, 1, &fence, VK_TRUE, UINT64_MAX);
+            CHECK_VK(vkResetFences(device.device, 1, &fence), abort());
+
             if (nwidth != width || nheight != height) {
                 width = nwidth;
                 height = nheight;
-                free(framebuffer);
-                framebuffer = reinterpret_cast<uint8_t*>(malloc(width * height * 4));
-
-                // unmap the old gpu buffer and reallocate it
-                vkUnmapMemory(device.device, buffer->memory);
                 buffer = std::make_unique<imr::Buffer>(device, width * height * 4, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-                CHECK_VK(vkMapMemory(device.device, buffer->memory, buffer->memory_offset, buffer->size, 0, (void**) &mapped_buffer), abort());
             }
 
-            vkWaitForFences(device.device, 1, &fence, VK_TRUE, UINT64_MAX);
-            CHECK_VK(vkResetFences(device.device, 1, &fence), abort());
-
+            auto framebuffer = reinterpret_cast<uint8_t*>(buffer->mapped().data());
             for (size_t i = 0 ; i < width; i++) {
                 for (size_t j = 0; j < height; j++) {
                     framebuffer[((j * width) + i) * 4 + 0] = rand() % 255;
@@ -53,7 +45,8 @@ int main() {
                     framebuffer[((j * width) + i) * 4 + 2] = rand() % 255;
                 }
             }
-            memcpy(mapped_buffer, framebuffer, width * height * 4);
+            // in case the memory isn't host-coherent
+            buffer->flush();
             frame.presentFromBuffer(buffer->handle, fence, std::nullopt);
         });
 
@@ -63,7 +56,6 @@ int main() {
     }
 
     vkDeviceWaitIdle(device.device);
-    free(framebuffer);
 
     vkDestroyFence(device.device, fence, nullptr);
 
@@ -29,6 +29,7 @@ int main() {
 
     imr::FpsCounter fps_counter;
 
+    // The set is allocated by hand below, so no push descriptors for this one
     imr::ComputePipeline shader(device, "present_from_image.spv");
 
     VkDescriptorPool pool;
@@ -86,23 +87,14 @@ int main() {
             vkWaitForFences(device.device, 1, &fence, VK_TRUE, UINT64_MAX);
             vkResetFences(device.device, 1, &fence);
 
-            VkCommandBuffer cmdbuf;
-            vkAllocateCommandBuffers(device.device, tmpPtr((VkCommandBufferAllocateInfo) {
-                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-                .commandPool = device.pool,
-                .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-                .commandBufferCount = 1,
-            }), &cmdbuf);
+            VkCommandBuffer cmdbuf = frame.allocateCommandBuffer();
 
             vkBeginCommandBuffer(cmdbuf, tmpPtr((VkCommandBufferBeginInfo) {
                 .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
                 .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
             }));
 
-            VkSemaphore sem;
-            vkCreateSemaphore(device.device, tmpPtr((VkSemaphoreCreateInfo) {
-                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-            }), nullptr, &sem);
+            VkSemaphore sem = device.getSemaphore();
             vk.cmdPipelineBarrier2KHR(cmdbuf, tmpPtr((VkDependencyInfo) {
                 .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
                 .dependencyFlags = 0,
@@ -174,8 +166,7 @@ int main() {
             }), VK_NULL_HANDLE);
 
             frame.addCleanupAction([=, &device]() {
-                vkDestroySemaphore(device.device, sem, nullptr);
-                vkFreeCommandBuffers(device.device, device.pool, 1, &cmdbuf);
+                device.recycleSemaphore(sem);
             });
             frame.presentFromImage(image->handle(), fence, { sem }, VK_IMAGE_LAYOUT_GENERAL, std::make_optional<VkExtent2D>(image->size().width, image->size().height));
         });
@@ -5,9 +5,14 @@
 #include "GLFW/glfw3.h"
 #include "VkBootstrap.h"
 
+#include <array>
 #include <functional>
+#include <future>
+#include <map>
 #include <memory>
 #include <optional>
+#include <span>
+#include <variant>
 
 #include <cstdio>
 
@@ -28,9 +33,65 @@ struct Context {
     vkb::Instance instance;
     vkb::InstanceDispatchTable dispatch;
 
+    /// Whether VK_EXT_headless_surface is enabled, which the headless Swapchain constructor needs
+    bool headless_surface_supported = false;
+
     std::vector<vkb::PhysicalDevice> available_devices(std::function<void(vkb::PhysicalDeviceSelector&)>&& device_custom = [](auto&) {});
 };
 
+struct BindlessHeap;
+
+/// Keeps `old` alive until `frame` retires, for things the frames in flight might still use, like a pipeline that was just replaced.
+/// `frame` is anything with addCleanupAction(), e.g. a Swapchain::Frame or a Swapchain::SimplifiedRenderContext.
+template<typename T, typename Frame>
+void keepAliveUntilRetired(Frame& frame, std::unique_ptr<T>&& old) {
+    std::shared_ptr<T> kept = std::move(old);
+    frame.addCleanupAction([kept]() {});
+}
+
+/// Something, typically a pipeline, being built on one of the Device's compile threads. See Device::compileAsync.
+/// Poll ready() from the render loop and keep using the previous pipeline until it is, get() waits for it.
+template<typename T>
+struct AsyncPipeline {
+    AsyncPipeline() = default;
+    explicit AsyncPipeline(std::future<std::unique_ptr<T>>&& future) : future(std::move(future)) {}
+
+    /// Whether get() returns without waiting. That includes when the build failed, get() rethrows the error then.
+    bool ready() const {
+        return value || (future.valid() && future.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    }
+
+    T& get() {
+        if (!value)
+            value = future.get();
+        return *value;
+    }
+    T& operator*() { return get(); }
+    T* operator->() { return &get(); }
+
+    /// Waits like get(), and hands the result over
+    std::unique_ptr<T> take() {
+        get();
+        return std::move(value);
+    }
+
+    /// Once ready(), hands the result over in place of `current`, which is kept alive until `frame` retires (see keepAliveUntilRetired).
+    /// Returns whether it did. A failed build is rethrown, and not tried again.
+    template<typename Frame>
+    bool replace(std::unique_ptr<T>& current, Frame& frame) {
+        if (!ready())
+            return false;
+        auto built = take();
+        keepAliveUntilRetired(frame, std::move(current));
+        current = std::move(built);
+        return true;
+    }
+
+private:
+    std::future<std::unique_ptr<T>> future;
+    std::unique_ptr<T> value;
+};
+
 struct Device {
     Device(Context&, std::function<void(vkb::PhysicalDeviceSelector&)>&& device_custom = [](auto&) {});
     Device(Context&, vkb::PhysicalDevice);
@@ -45,16 +106,95 @@ struct Device {
     VkQueue main_queue;
     uint32_t main_queue_idx;
 
+    /// Queue from a transfer-only family, if the device has one, VK_NULL_HANDLE otherwise
+    VkQueue transfer_queue = VK_NULL_HANDLE;
+    uint32_t transfer_queue_idx;
+
+    /// Queue from a compute family without graphics support, if the device has one, VK_NULL_HANDLE otherwise.
+    /// compute_queue_idx and compute_pool fall back to the main queue's family. See Swapchain::Frame::submitAsyncCompute.
+    VkQueue compute_queue = VK_NULL_HANDLE;
+    uint32_t compute_queue_idx;
+
     VkCommandPool pool;
+    VkCommandPool compute_pool;
+
+    /// Used by all the pipelines. It's loaded at startup and saved when the Device is destroyed, next to the executable.
+    /// Set IMR_PIPELINE_CACHE to use another file, or to an empty value to not use one.
+    VkPipelineCache pipeline_cache;
 
     vkb::DispatchTable dispatch;
 
     void executeCommandsSync(std::function<void(VkCommandBuffer)>);
 
+    /// Pooled synchronization objects, so the frame loop doesn't have to create and destroy them all the time.
+    /// Fences are handed out unsignaled, and you must only recycle them once nothing is waiting on them anymore.
+    /// Semaphores must only be recycled once every wait on them has completed.
+    /// None of this is thread-safe.
+    VkFence getFence();
+    void recycleFence(VkFence);
+    VkSemaphore getSemaphore();
+    void recycleSemaphore(VkSemaphore);
+
+    /// Every submission imr makes to the main queue signals this timeline semaphore with a new, monotonically increasing value.
+    /// This lets us track retirement of GPU work without juggling one fence per submission.
+    VkSemaphore timeline;
+    /// Reserves the value the next submission must signal on the timeline
+    uint64_t nextTimelineValue();
+    uint64_t completedTimelineValue();
+    void waitForTimelineValue(uint64_t value);
+
+    /// Schedules fn to run once the timeline has reached value, from within collectGarbage()
+    void deferCleanup(uint64_t value, std::function<void(void)>&& fn);
+    /// Runs all the deferred cleanup whose timeline value has been reached. Never blocks.
+    void collectGarbage();
+    /// The staging space of the Buffer::uploadDataAsync calls so far is reused once the timeline reaches value, that of the submission
+    /// their command buffers went into (or a later one). Presenting a Swapchain::Frame and executeCommandsSync() take care of it,
+    /// otherwise call this after submitting, or uploads end up in one-off staging buffers once the space runs out.
+    void retireStagedUploads(uint64_t value);
+
+    /// Runs build on a pool of compile threads, so the render loop doesn't stall while the driver compiles pipelines.
+    /// Building ShaderModule, ShaderEntryPoint, ComputePipeline and GraphicsPipeline objects is safe there, recording commands is not.
+    template<typename T>
+    AsyncPipeline<T> compileAsync(std::function<std::unique_ptr<T>()>&& build) {
+        auto task = std::make_shared<std::packaged_task<std::unique_ptr<T>()>>(std::move(build));
+        AsyncPipeline<T> pending(task->get_future());
+        runOnCompileThread([task]() { (*task)(); });
+        return pending;
+    }
+    /// Jobs still queued when the Device is destroyed are dropped. Call this from one thread only.
+    /// Pipelines built by the job go by use_descriptor_buffers as it was when this was called.
+    void runOnCompileThread(std::function<void(void)>&& job);
+
+    /// Whether the descriptor indexing features the BindlessHeap needs are enabled
+    bool bindless_supported = false;
+    /// Created on first use, pipelines opt into it with PipelineOptions::bindless. Throws if !bindless_supported.
+    BindlessHeap& bindless();
+
+    /// Whether VK_EXT_descriptor_buffer is enabled
+    bool descriptor_buffer_supported = false;
+    /// Pipelines created while this is set get bind helpers that write descriptors straight into host-visible descriptor buffers,
+    /// instead of allocating and updating descriptor sets. Needs descriptor_buffer_supported, and doesn't mix with the bindless heap.
+    bool use_descriptor_buffers = false;
+
     class Impl;
     std::unique_ptr<Impl> _impl;
 };
 
+/// What the GPU was last asked to do with a buffer or image, as far as the BarrierBatcher knows.
+/// This follows recording order, so it's only right if command buffers are submitted in the order they were recorded.
+/// Barriers recorded by hand should update it, or leave it more conservative than it really is.
+struct ResourceState {
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    /// Writes since the last barrier that made them visible to everything
+    VkPipelineStageFlags2 write_stages = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 write_access = VK_ACCESS_2_NONE;
+    /// Where those writes were already made visible
+    VkPipelineStageFlags2 visible_stages = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 visible_access = VK_ACCESS_2_NONE;
+    /// Reads since the last write, which later writes have to wait for
+    VkPipelineStageFlags2 read_stages = VK_PIPELINE_STAGE_2_NONE;
+};
+
 struct Buffer {
     Buffer(Device&, size_t size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memory_property = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
     Buffer(Buffer&) = delete;
@@ -64,18 +204,32 @@ struct Buffer {
     VkBuffer handle;
     /// query 64-bit virtual address of the buffer on the GPU
     VkDeviceAddress device_address();
-    /// Managed by the allocator, required for mapping the buffer
+    /// Managed by the allocator, and possibly shared with other buffers. Use mapped() rather than mapping this yourself.
     VkDeviceMemory memory;
     size_t memory_offset;
 
+    /// Host-visible buffers are persistently mapped, this is empty for the others.
+    /// Writes to non-coherent memory need a flush() before the GPU sees them, and reads an invalidate() after the GPU wrote.
+    std::span<std::byte> mapped() const;
+    void flush(uint64_t offset = 0, uint64_t size = VK_WHOLE_SIZE);
+    void invalidate(uint64_t offset = 0, uint64_t size = VK_WHOLE_SIZE);
+
     void uploadDataSync(uint64_t offset, uint64_t size, void* data);
+    /// Records a copy of the data into the command buffer, staging it through a ring buffer owned by the Device.
+    /// The staging space is reclaimed when the next frame to be presented retires, so the command buffer has to be submitted by then.
+    /// Without a Swapchain, see Device::retireStagedUploads().
+    /// The copy waits for the earlier uses in state(), later ones see it once they require() the buffer from a BarrierBatcher.
+    void uploadDataAsync(VkCommandBuffer cmdbuf, uint64_t offset, uint64_t size, void* data);
+
+    /// Kept up to date by the BarrierBatcher
+    ResourceState& state();
 
     struct Impl;
     std::unique_ptr<Impl> _impl;
 };
 
 /// Deals with the common use-cases for images, allocating memory for you and tracking properties.
-/// Does not track image layouts for you, much of the framework assumes VK_IMAGE_LAYOUT_GENERAL
+/// Layouts are only tracked if you go through a BarrierBatcher, much of the framework assumes VK_IMAGE_LAYOUT_GENERAL
 struct Image {
     VkImage handle() const;
 
@@ -90,18 +244,91 @@ struct Image {
 
     VkImageSubresourceRange whole_image_subresource_range() const;
 
+    /// Views are created on first use and cached, they live as long as the image does.
+    /// By default, a view of the whole image in its own format.
+    VkImageView view(std::optional<VkImageViewType> = std::nullopt, std::optional<VkImageSubresourceRange> = std::nullopt, std::optional<VkFormat> = std::nullopt);
+    /// Index of the image in the device's BindlessHeap, assigned on first use and stable for the life of the image.
+    /// It's the same in the storage and in the sampled image arrays, the image shows up in those its usage allows.
+    uint32_t bindless_index();
+
+    /// Layout and pending accesses, kept up to date by the BarrierBatcher. Covers the whole image.
+    ResourceState& state();
+
     struct Impl;
     Image(Impl&&);
 private:
     std::unique_ptr<Impl> _impl;
 };
 
+/// Works out the barriers needed before the next command from what the resources it uses are in for, and what they went through before.
+/// Say what the next dispatch, draw or copy does with each resource, then flush() right before recording it:
+///
+///     barriers.require(image, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+///     barriers.require(buffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+///     barriers.flush();
+///     vkCmdDispatch(...);
+///
+/// Only what's actually needed is emitted (nothing for read after read), narrowed to the stages involved, and all of it in one vkCmdPipelineBarrier2.
+struct BarrierBatcher {
+    BarrierBatcher(Device&, VkCommandBuffer);
+    BarrierBatcher(BarrierBatcher&) = delete;
+    /// Everything required must have been flushed
+    ~BarrierBatcher();
+
+    void require(Image&, VkPipelineStageFlags2 stage, VkAccessFlags2 access, VkImageLayout layout = VK_IMAGE_LAYOUT_GENERAL);
+    void require(Buffer&, VkPipelineStageFlags2 stage, VkAccessFlags2 access);
+    /// Records the pending barriers, if there are any
+    void flush();
+    /// The recording moved on to another command buffer, flushes first
+    void setCommandBuffer(VkCommandBuffer);
+
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+/// The value of a specialization constant, it must have the same type as in the shader. Booleans are passed as VkBool32.
+using SpecializationConstant = std::variant<bool, int32_t, uint32_t, float, int64_t, uint64_t, double>;
+/// Values for specialization constants, by constant_id
+using SpecializationConstants = std::map<uint32_t, SpecializationConstant>;
+
+/// One global descriptor set with big arrays of storage images, sampled images and samplers, updated after being bound.
+/// Shaders index it with ids passed through push constants, the same way the examples pass buffer device addresses:
+///
+///     layout(set = 3, binding = 0) uniform image2D storage_images[];
+///     layout(set = 3, binding = 1) uniform texture2D sampled_images[];
+///     layout(set = 3, binding = 2) uniform sampler samplers[];
+///
+/// Pipelines created with it in PipelineOptions::bindless use its layout for that set, and their bind helpers bind it along with the others.
+struct BindlessHeap {
+    static constexpr uint32_t set = 3;
+    static constexpr uint32_t storage_images_binding = 0;
+    static constexpr uint32_t sampled_images_binding = 1;
+    static constexpr uint32_t samplers_binding = 2;
+
+    BindlessHeap(Device&);
+    BindlessHeap(BindlessHeap&) = delete;
+    ~BindlessHeap();
+
+    VkDescriptorSetLayout set_layout() const;
+    VkDescriptorSet descriptor_set() const;
+    void bind(VkCommandBuffer, VkPipelineBindPoint, VkPipelineLayout);
+
+    /// The sampler must outlive its use by the GPU, the slot is given back by removeSampler
+    uint32_t addSampler(VkSampler);
+    void removeSampler(uint32_t index);
+
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
 struct ShaderModule {
     ShaderModule(imr::Device& device, std::string&& filename) noexcept(false);
     ShaderModule(const ShaderModule&) = delete;
     ShaderModule(ShaderModule&&) = default;
 
     VkShaderModule vk_shader_module() const;
+    /// The constant_id of every specialization constant declared in the module
+    std::vector<uint32_t> specialization_ids() const;
 
     ~ShaderModule();
 
@@ -110,12 +337,13 @@ struct ShaderModule {
 };
 
 struct ShaderEntryPoint {
-    ShaderEntryPoint(ShaderModule& module, VkShaderStageFlagBits stage, const std::string& entrypoint_name);
+    ShaderEntryPoint(ShaderModule& module, VkShaderStageFlagBits stage, const std::string& entrypoint_name, SpecializationConstants specialization = {});
     ~ShaderEntryPoint();
 
     VkShaderStageFlagBits stage() const;
     const std::string& name() const;
     const ShaderModule& module() const;
+    const SpecializationConstants& specialization() const;
 
     struct Impl;
     std::unique_ptr<Impl> _impl;
@@ -132,17 +360,31 @@ struct DescriptorBindHelper {
     ~DescriptorBindHelper();
 
     void set_storage_image(uint32_t set, uint32_t binding, Image& image, std::optional<VkImageSubresourceRange> = std::nullopt, std::optional<VkImageViewType> = std::nullopt);
+    /// Binds the descriptor sets, this can be done for several command buffers but the sets can't be changed anymore afterwards
     void commit(VkCommandBuffer);
 
     std::unique_ptr<Impl> _impl;
 };
 
+/// How a ComputePipeline or GraphicsPipeline binds its descriptors
+struct PipelineOptions {
+    /// The first descriptor set small enough is pushed by the bind helpers when VK_KHR_push_descriptor is there.
+    /// Descriptor sets allocated from that set's set_layout() can't be bound anymore then, so leave it off if you manage sets yourself.
+    bool push_descriptors = false;
+    /// Puts this heap in BindlessHeap::set, whatever bindings the shader has there must be the heap's. Get it with Device::bindless()
+    /// on the thread that owns the Device, also for pipelines built with compileAsync, and pass it in from there.
+    BindlessHeap* bindless = nullptr;
+};
+
 struct ComputePipeline {
-    ComputePipeline(Device&, std::string&& spirv_filename, std::string&& entrypoint_name = "main");
+    ComputePipeline(Device&, std::string&& spirv_filename, std::string&& entrypoint_name = "main", SpecializationConstants specialization = {}, PipelineOptions options = {});
     ComputePipeline(ComputePipeline&) = delete;
     ~ComputePipeline();
 
     VkPipeline pipeline() const;
+    /// The same pipeline with other specialization constants. Each variant is built on first use and kept as long as the ComputePipeline,
+    /// they all share its layout.
+    VkPipeline pipeline(const SpecializationConstants&);
     VkPipelineLayout layout() const;
     VkDescriptorSetLayout set_layout(unsigned) const;
 
@@ -182,7 +424,7 @@ struct GraphicsPipeline {
     static VkPipelineRasterizationStateCreateInfo solid_filled_polygons();
     static VkPipelineDepthStencilStateCreateInfo simple_depth_testing();
 
-    GraphicsPipeline(Device&, std::vector<ShaderEntryPoint*>&& stages, RenderTargetsState, StateBuilder);
+    GraphicsPipeline(Device&, std::vector<ShaderEntryPoint*>&& stages, RenderTargetsState, StateBuilder, PipelineOptions options = {});
     GraphicsPipeline(const GraphicsPipeline&) = delete;
     ~GraphicsPipeline();
 
@@ -198,13 +440,37 @@ struct GraphicsPipeline {
 
 struct Swapchain {
     Swapchain(Device&, GLFWwindow* window);
+    /// Headless swapchain, backed by VK_EXT_headless_surface instead of a window. Frames render the same, but are never shown anywhere.
+    /// Use onFrameReadback to get at the pixels.
+    Swapchain(Device&, VkExtent2D size);
     ~Swapchain();
 
     Device& device() const;
     VkFormat format() const;
 
-    /// Approximate FPS cap, avoids melting your GPU on a trivial scene
+    /// FPS cap, avoids melting your GPU on a trivial scene. 999 and up means no cap.
     int maxFps = 999;
+    /// Use VK_KHR_present_wait, if the device supports it, to wait for the previous frame to actually be shown before presenting another one
+    bool usePresentWait = false;
+
+    /// How well queuePresent() managed to stick to maxFps. All times are in seconds, averaged over the last few dozen frames.
+    struct PacingStats {
+        /// 0 without a cap
+        float target_frametime;
+        float average_frametime;
+        float frametime_deviation;
+        /// How late (or early) frames were released, compared to when they were meant to be
+        float average_error;
+    };
+    PacingStats pacingStats() const;
+
+    /// How many frames the CPU may record ahead of the GPU, independently of how many images the swapchain has.
+    /// Lower values mean less latency, higher values give more overlap between the CPU and GPU.
+    int maxFramesInFlight = 2;
+
+    /// If set, frames rendered through renderFrameSimplified() are copied back to the host, and handed to this once the GPU is done with them.
+    /// The pixels are tightly packed in format() and are only valid during the call. This doesn't stall the frame loop, but it does cost a copy.
+    std::function<void(size_t frame_id, VkExtent2D size, const void* pixels)> onFrameReadback;
 
     struct Frame {
         void presentFromBuffer(VkBuffer buffer, VkFence signal_when_reusable, std::optional<VkSemaphore> sem);
@@ -219,6 +485,20 @@ struct Swapchain {
         void addCleanupFence(VkFence fence);
         void addCleanupAction(std::function<void(void)>&& fn);
 
+        /// Makes the submissions imr does for this frame (renderFrameSimplified, presentFromBuffer/Image) wait on a semaphore.
+        /// The value is ignored for binary semaphores.
+        void addWaitSemaphore(VkSemaphore, uint64_t value, VkPipelineStageFlags stages);
+
+        /// Records work through `record` and submits it right away to the async compute queue (or the main queue if there is none), where it overlaps with graphics work.
+        /// It runs after previous frames are done on the main queue, but not necessarily after this one's earlier work. imr's later submissions for this frame wait for it.
+        /// `images` are handed over to the compute queue and back: their previous contents are discarded, and they're left in VK_IMAGE_LAYOUT_GENERAL.
+        /// Their state() says so on both sides, so a BarrierBatcher picks up from there in `record` and afterwards.
+        void submitAsyncCompute(std::function<void(VkCommandBuffer)>&& record, std::vector<Image*> images = {});
+
+        /// Hands out a command buffer from a pool owned by the swapchain.
+        /// It is recycled along with the frame, so you don't need to (and shouldn't) free it yourself.
+        VkCommandBuffer allocateCommandBuffer();
+
         void withRenderTargets(VkCommandBuffer, std::vector<Image*> color_images, Image* depth, std::function<void()> f);
 
         class Impl;
@@ -241,6 +521,10 @@ struct Swapchain {
         virtual Swapchain::Frame& frame() const = 0;
 
         virtual void addCleanupAction(std::function<void(void)>&& fn) = 0;
+
+        /// Submits what was recorded so far, and carries on in a new command buffer, which cmdbuf() returns from then on.
+        /// That way the work recorded so far doesn't wait on whatever the frame is made to wait on afterwards, e.g. by submitAsyncCompute().
+        virtual void flush() = 0;
     };
 
     /// Simplified API to draw a frame, deals with cmdbuf allocation, recording and submission, as well as layout transitions in and out of VK_IMAGE_LAYOUT_GENERAL for the swapchain image
@@ -255,7 +539,97 @@ struct Swapchain {
     std::unique_ptr<Impl> _impl;
 };
 
+/// Records a frame as a list of passes, each declaring the images it uses and how. From that, the graph:
+///  - puts barriers in front of each pass, only for what it depends on (see BarrierBatcher),
+///  - backs transient images with memory shared by those that are never needed at the same time,
+///  - sends ASYNC_COMPUTE passes to the compute queue, and lets the main queue passes that don't depend on them go first.
+/// Passes are recorded when execute() is called, in the order they were added, short of that last point.
+struct RenderGraph {
+    using ImageId = uint32_t;
+    enum class Queue { MAIN, ASYNC_COMPUTE };
+
+    RenderGraph(Swapchain::SimplifiedRenderContext&);
+    RenderGraph(RenderGraph&) = delete;
+    ~RenderGraph();
+
+    /// Keeps its contents, and its ResourceState is used and kept up to date
+    ImageId importImage(Image&);
+    /// Only lives during this frame, with undefined contents to begin with. It's created by execute(), use image() from within the passes.
+    ImageId createImage(VkImageType, VkExtent3D size, VkFormat, VkImageUsageFlags);
+
+    struct PassContext;
+    struct Pass {
+        struct Use {
+            ImageId image;
+            VkPipelineStageFlags2 stage;
+            VkAccessFlags2 access;
+            VkImageLayout layout;
+        };
+
+        std::string name;
+        Queue queue;
+        std::vector<Use> uses;
+        std::function<void(PassContext&)> record;
+
+        Pass& use(ImageId, VkPipelineStageFlags2, VkAccessFlags2, VkImageLayout = VK_IMAGE_LAYOUT_GENERAL);
+        Pass& read(ImageId image, VkPipelineStageFlags2 stage = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT) { return use(image, stage, VK_ACCESS_2_SHADER_STORAGE_READ_BIT); }
+        Pass& write(ImageId image, VkPipelineStageFlags2 stage = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT) { return use(image, stage, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT); }
+        Pass& readWrite(ImageId image, VkPipelineStageFlags2 stage = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT) { return use(image, stage, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT); }
+    };
+
+    struct PassContext {
+        RenderGraph& graph;
+        Pass& pass;
+        VkCommandBuffer cmdbuf;
+        BarrierBatcher& barriers;
+
+        Image& image(ImageId id) { return graph.image(id); }
+        /// Orders what comes next in the pass after what came before, for the images the pass uses
+        void barrier();
+    };
+
+    /// ASYNC_COMPUTE passes get their images' contents discarded when they start, so the first of them to use an imported image must only write it, all of it.
+    /// Those images can't be used by MAIN passes added before them either. Passes that don't fit these rules run on the main queue instead.
+    Pass& addPass(std::string name, Queue, std::function<void(PassContext&)>&& record);
+
+    Image& image(ImageId);
+    void execute();
+
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+/// Batches buffer and image uploads into as few submissions as possible, on the dedicated transfer queue when there is one, so they overlap with rendering.
+/// Each submission signals a timeline semaphore of its own, and acquire() makes a frame wait for it and takes ownership of the uploaded resources.
+/// The resources must not be in use by the GPU while they're uploaded to, their previous contents are lost. None of this is thread-safe.
+struct UploadEngine {
+    UploadEngine(Device&);
+    UploadEngine(UploadEngine&) = delete;
+    ~UploadEngine();
+
+    void uploadBuffer(Buffer&, uint64_t offset, uint64_t size, const void* data);
+    /// Fills the first mip level and layer of the image with tightly packed pixels, and leaves it in the given layout. Its state() is set to that for the main queue.
+    void uploadImage(Image&, const void* data, size_t size, VkImageLayout final_layout = VK_IMAGE_LAYOUT_GENERAL);
+
+    /// Submits everything uploaded so far, and returns the value the timeline will reach once that's done
+    uint64_t flush();
+    /// Flushes, makes the frame wait on all uploads so far, and records the ownership transfers of the uploaded resources into the command buffer.
+    /// The command buffer must be submitted as part of the frame, and before anything else uses the resources.
+    void acquire(Swapchain::Frame&, VkCommandBuffer);
+
+    VkSemaphore timeline() const;
+    bool isDone(uint64_t value);
+    void wait(uint64_t value);
+
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+/// Call tick() once per frame. The averages and percentiles are updated about once a second.
 struct FpsCounter {
+    /// How many of the last frame times the percentiles are taken over
+    static constexpr size_t history_size = 1024;
+
     FpsCounter();
     FpsCounter(FpsCounter&) = delete;
     ~FpsCounter();
@@ -263,12 +637,119 @@ struct FpsCounter {
     void tick();
     int average_fps();
     float average_frametime();
+
+    /// Frame times in seconds, the mean hides the stutters these show
+    struct Percentiles {
+        float p50;
+        float p95;
+        float p99;
+        float max;
+        /// The frame rate of the slowest 1% of frames
+        float one_percent_low_fps;
+    };
+    Percentiles percentiles();
+
+    /// Upper bounds of the histogram buckets in milliseconds, the frame times of 240, 144, 120, 90, 60, 30, 20 and 10 fps
+    static constexpr std::array<float, 8> histogram_bounds = { 4.17f, 6.94f, 8.33f, 11.1f, 16.7f, 33.3f, 50.0f, 100.0f };
+    /// How many of the frame times kept fall in each bucket: bucket i counts those up to histogram_bounds[i], slower than the bucket before.
+    /// The last bucket has everything slower than 100ms.
+    using Histogram = std::array<uint32_t, histogram_bounds.size() + 1>;
+    /// Updated along with the percentiles
+    Histogram histogram();
+
+    /// Writes the frame times kept, oldest first, as CSV with the frame number and milliseconds
+    void dumpCsv(FILE*);
+
     void updateGlfwWindowTitle(GLFWwindow*);
 
     class Impl;
     std::unique_ptr<Impl> _impl;
 };
 
+/// Measures how long the GPU spends in scopes of the command buffers of a Swapchain's frames, using timestamp queries:
+///
+///     {
+///         auto scope = profiler.scope(cmdbuf, "shadow pass");
+///         vkCmdDispatch(...);
+///     }
+///
+/// Scopes also show up as debug labels in tools like RenderDoc. Each frame gets query pools of its own, read once it has retired, so nothing ever waits on the GPU.
+/// Scopes with the same name add up within a frame, and the stats cover the last `window` frames they were used in.
+/// Without VkPhysicalDeviceHostQueryResetFeatures or timestamp support on the queues, only the labels are emitted.
+/// The profiler must outlive the frames it was used in, Swapchain::drain() takes care of that.
+struct GpuProfiler {
+    static constexpr size_t window = 120;
+
+    GpuProfiler(Swapchain&, uint32_t max_scopes_per_frame = 256);
+    GpuProfiler(GpuProfiler&) = delete;
+    ~GpuProfiler();
+
+    /// Ends when it goes out of scope, which has to happen while the command buffer is still recording
+    struct Scope {
+        GpuProfiler& profiler;
+        VkCommandBuffer cmdbuf;
+        /// Where the end timestamp goes, if the scope is timed at all
+        VkQueryPool pool;
+        uint32_t end_query;
+
+        Scope(GpuProfiler&, VkCommandBuffer, VkQueryPool, uint32_t end_query);
+        Scope(Scope&) = delete;
+        ~Scope();
+    };
+    /// Only valid while recording one of the swapchain's frames. Scopes beyond max_scopes_per_frame are only labelled.
+    Scope scope(VkCommandBuffer, const char* name);
+
+    /// In milliseconds
+    struct Stats {
+        std::string name;
+        size_t samples;
+        float last;
+        float average;
+        float min;
+        float max;
+    };
+    /// Scopes that haven't been measured yet are left out
+    std::vector<Stats> stats() const;
+    /// False if only the labels are emitted
+    bool timestamps_supported() const;
+
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+/// Records spans of what imr does on the CPU: acquiring, submitting and presenting, waiting on the GPU, pacing frames and creating pipelines.
+/// The GpuProfiler scopes go on the same timeline, when VK_EXT_calibrated_timestamps lets us line up the clocks (only on Linux so far).
+/// writeJson() outputs the Chrome trace format, which Perfetto (ui.perfetto.dev) and chrome://tracing open.
+/// Only one Tracer per Device at a time, destroy it once nothing is being recorded anymore (after Swapchain::drain() and the pipeline builds).
+/// Each thread records into a buffer of its own, and nothing is recorded without a Tracer.
+struct Tracer {
+    /// Each thread, and the GPU, keeps its last max_events events. Older ones are dropped, the JSON says how many.
+    Tracer(Device&, size_t max_events = 1 << 18);
+    Tracer(Tracer&) = delete;
+    ~Tracer();
+
+    struct Impl;
+
+    /// Records a span on the calling thread, until it goes out of scope or end() is called.
+    /// The name has to outlive the Tracer, a string literal does.
+    struct Span {
+        Span(Device&, const char* name);
+        Span(Span&) = delete;
+        ~Span();
+        void end();
+
+        Tracer::Impl* tracer;
+        const char* name;
+        uint64_t begin;
+    };
+
+    /// Everything recorded so far, recording can go on meanwhile
+    void writeJson(FILE*);
+    bool writeJson(const char* path);
+
+    std::unique_ptr<Impl> _impl;
+};
+
 }
 
 #endif
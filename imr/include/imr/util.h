@@ -7,8 +7,10 @@ extern "C" {
 #include <stddef.h>
 #include <stdbool.h>
 
+/// Monotonic clock with nanosecond resolution, only meaningful for measuring intervals
 uint64_t imr_get_time_nano(void);
 bool imr_read_file(const char* filename, size_t* size, unsigned char** output);
+bool imr_write_file(const char* filename, size_t size, const char* data);
 
 const char* imr_get_executable_location(void);
 
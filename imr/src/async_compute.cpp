@@ -0,0 +1,113 @@
+#include "swapchain_private.h"
+
+namespace imr {
+
+void Swapchain::Frame::submitAsyncCompute(std::function<void(VkCommandBuffer)>&& record, std::vector<Image*> images) {
+    auto& device = _impl->device;
+    auto& vk = device.dispatch;
+    auto& in_flight = _impl->in_flight;
+    bool ownership_transfer = device.compute_queue != VK_NULL_HANDLE;
+    VkQueue queue = ownership_transfer ? device.compute_queue : device.main_queue;
+
+    VkCommandBuffer cmdbuf = in_flight.get_command_buffer(in_flight.compute_command_pool);
+    CHECK_VK_THROW(vkBeginCommandBuffer(cmdbuf, tmpPtr((VkCommandBufferBeginInfo) {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    })));
+
+    // The images' contents are discarded, so there is nothing to acquire from the main queue, this just makes them ours.
+    // before the barrier: whatever used the images in earlier submissions, which we wait on
+    // after the barrier: anything in the compute work
+    std::vector<VkImageMemoryBarrier2> barriers;
+    for (auto image : images) {
+        barriers.push_back((VkImageMemoryBarrier2) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            .srcAccessMask = VK_ACCESS_2_NONE,
+            .dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            .dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+            .image = image->handle(),
+            .subresourceRange = image->whole_image_subresource_range(),
+        });
+    }
+    if (!barriers.empty()) {
+        vk.cmdPipelineBarrier2KHR(cmdbuf, tmpPtr((VkDependencyInfo) {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .imageMemoryBarrierCount = static_cast<uint32_t>(barriers.size()),
+            .pImageMemoryBarriers = barriers.data(),
+        }));
+    }
+    // that barrier leaves nothing pending, a BarrierBatcher in `record` starts from there
+    for (auto image : images)
+        image->state() = { .layout = VK_IMAGE_LAYOUT_GENERAL };
+
+    record(cmdbuf);
+
+    // Hand the images back to the main queue, the matching acquires go ahead of our next submission there
+    if (ownership_transfer) {
+        barriers.clear();
+        for (auto image : images) {
+            VkImageMemoryBarrier2 barrier = {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                .srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                .srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT,
+                .dstStageMask = VK_PIPELINE_STAGE_2_NONE,
+                .dstAccessMask = VK_ACCESS_2_NONE,
+                .oldLayout = VK_IMAGE_LAYOUT_GENERAL,
+                .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+                .srcQueueFamilyIndex = device.compute_queue_idx,
+                .dstQueueFamilyIndex = device.main_queue_idx,
+                .image = image->handle(),
+                .subresourceRange = image->whole_image_subresource_range(),
+            };
+            barriers.push_back(barrier);
+
+            barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+            barrier.srcAccessMask = VK_ACCESS_2_NONE;
+            barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+            barrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+            _impl->image_acquires.push_back(barrier);
+        }
+        if (!barriers.empty()) {
+            vk.cmdPipelineBarrier2KHR(cmdbuf, tmpPtr((VkDependencyInfo) {
+                .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                .imageMemoryBarrierCount = static_cast<uint32_t>(barriers.size()),
+                .pImageMemoryBarriers = barriers.data(),
+            }));
+        }
+    }
+    CHECK_VK_THROW(vkEndCommandBuffer(cmdbuf));
+    // Our later submissions wait for this one, and acquire the images in the same barrier if there was a hand-over, which leaves nothing pending for them either
+    for (auto image : images)
+        image->state() = { .layout = VK_IMAGE_LAYOUT_GENERAL };
+
+    // Waiting on the main timeline orders us after the previous frames, which might still be reading the images.
+    // This frame's earlier submissions (see SimplifiedRenderContext::flush) don't signal it, so they can overlap with us, as can the later ones up to their wait.
+    uint64_t main_value = device._impl->last_timeline_value;
+    uint64_t compute_value = ++device._impl->last_compute_value;
+    Tracer::Span submit_span(device, "submit async compute");
+    CHECK_VK_THROW(vkQueueSubmit(queue, 1, tmpPtr((VkSubmitInfo) {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = tmpPtr((VkTimelineSemaphoreSubmitInfo) {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .waitSemaphoreValueCount = 1,
+            .pWaitSemaphoreValues = &main_value,
+            .signalSemaphoreValueCount = 1,
+            .pSignalSemaphoreValues = &compute_value,
+        }),
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = &device.timeline,
+        .pWaitDstStageMask = tmpPtr((VkPipelineStageFlags) VK_PIPELINE_STAGE_ALL_COMMANDS_BIT),
+        .commandBufferCount = 1,
+        .pCommandBuffers = &cmdbuf,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &device._impl->compute_timeline,
+    }), VK_NULL_HANDLE));
+    submit_span.end();
+
+    addWaitSemaphore(device._impl->compute_timeline, compute_value, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+}
+
+}
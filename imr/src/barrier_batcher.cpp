@@ -0,0 +1,169 @@
+#include "imr_private.h"
+
+#include <unordered_map>
+
+namespace imr {
+
+struct BarrierBatcher::Impl {
+    Device& device;
+    VkCommandBuffer cmdbuf;
+
+    std::vector<VkImageMemoryBarrier2> image_barriers;
+    std::vector<VkBufferMemoryBarrier2> buffer_barriers;
+    /// Where the resources required since the last flush are in the barriers above
+    std::unordered_map<VkImage, size_t> pending_images;
+    std::unordered_map<VkBuffer, size_t> pending_buffers;
+
+    /// Works out the barrier for one resource, returns false if none is needed
+    static bool barrier_for(ResourceState& state, VkPipelineStageFlags2 stage, VkAccessFlags2 access, VkImageLayout layout, VkPipelineStageFlags2& src_stage, VkAccessFlags2& src_access);
+    /// The resource is used by the next command, which the pending barriers are already ordered before
+    static void note_use(ResourceState& state, VkPipelineStageFlags2 stage, VkAccessFlags2 access);
+};
+
+bool BarrierBatcher::Impl::barrier_for(ResourceState& state, VkPipelineStageFlags2 stage, VkAccessFlags2 access, VkImageLayout layout, VkPipelineStageFlags2& src_stage, VkAccessFlags2& src_access) {
+    bool writes = access & write_access_flags;
+    bool transition = layout != state.layout;
+    bool visible = (stage & ~state.visible_stages) == 0 && (access & ~state.visible_access) == 0;
+    src_stage = VK_PIPELINE_STAGE_2_NONE;
+    src_access = VK_ACCESS_2_NONE;
+
+    if (!writes && !transition) {
+        // read after read, or after writes we already waited for
+        if (!state.write_stages || visible)
+            return false;
+        // read after write
+        src_stage = state.write_stages;
+        src_access = state.write_access;
+        state.visible_stages |= stage;
+        state.visible_access |= access;
+        return true;
+    }
+
+    // first use, or only after barriers that already made everything visible
+    if (!transition && !state.write_stages && !state.read_stages)
+        return false;
+
+    // write after write or read, or a layout transition, which also counts as a write
+    src_stage = state.write_stages | state.read_stages;
+    src_access = state.write_access;
+    state.write_stages = VK_PIPELINE_STAGE_2_NONE;
+    state.write_access = VK_ACCESS_2_NONE;
+    state.read_stages = VK_PIPELINE_STAGE_2_NONE;
+    state.visible_stages = VK_PIPELINE_STAGE_2_NONE;
+    state.visible_access = VK_ACCESS_2_NONE;
+    if (transition) {
+        // the transition is only ordered before the stages we asked for, later uses elsewhere still need to wait on it
+        state.layout = layout;
+        state.write_stages = stage;
+        state.visible_stages = stage;
+        state.visible_access = access;
+    }
+    return true;
+}
+
+void BarrierBatcher::Impl::note_use(ResourceState& state, VkPipelineStageFlags2 stage, VkAccessFlags2 access) {
+    if (access & write_access_flags) {
+        state.write_stages |= stage;
+        state.write_access |= access & write_access_flags;
+        state.visible_stages = VK_PIPELINE_STAGE_2_NONE;
+        state.visible_access = VK_ACCESS_2_NONE;
+    } else {
+        state.read_stages |= stage;
+    }
+}
+
+BarrierBatcher::BarrierBatcher(Device& device, VkCommandBuffer cmdbuf) {
+    _impl = std::make_unique<Impl>(device, cmdbuf);
+}
+
+BarrierBatcher::~BarrierBatcher() {
+    assert(_impl->image_barriers.empty() && _impl->buffer_barriers.empty() && "required barriers were never flushed");
+}
+
+void BarrierBatcher::require(Image& image, VkPipelineStageFlags2 stage, VkAccessFlags2 access, VkImageLayout layout) {
+    auto& state = image.state();
+
+    // Already waiting on a barrier, the next command can piggyback on it
+    if (auto found = _impl->pending_images.find(image.handle()); found != _impl->pending_images.end()) {
+        auto& barrier = _impl->image_barriers[found->second];
+        if (barrier.newLayout == layout) {
+            barrier.dstStageMask |= stage;
+            barrier.dstAccessMask |= access;
+            Impl::note_use(state, stage, access);
+            return;
+        }
+        // it can't be in two layouts at once, so that's two separate uses, one after the other
+        flush();
+    }
+
+    VkImageLayout old_layout = state.layout;
+    VkPipelineStageFlags2 src_stage;
+    VkAccessFlags2 src_access;
+    if (Impl::barrier_for(state, stage, access, layout, src_stage, src_access)) {
+        _impl->pending_images[image.handle()] = _impl->image_barriers.size();
+        _impl->image_barriers.push_back((VkImageMemoryBarrier2) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+            .srcStageMask = src_stage,
+            .srcAccessMask = src_access,
+            .dstStageMask = stage,
+            .dstAccessMask = access,
+            .oldLayout = old_layout,
+            .newLayout = layout,
+            .image = image.handle(),
+            .subresourceRange = image.whole_image_subresource_range(),
+        });
+    }
+    Impl::note_use(state, stage, access);
+}
+
+void BarrierBatcher::require(Buffer& buffer, VkPipelineStageFlags2 stage, VkAccessFlags2 access) {
+    auto& state = buffer.state();
+
+    if (auto found = _impl->pending_buffers.find(buffer.handle); found != _impl->pending_buffers.end()) {
+        auto& barrier = _impl->buffer_barriers[found->second];
+        barrier.dstStageMask |= stage;
+        barrier.dstAccessMask |= access;
+        Impl::note_use(state, stage, access);
+        return;
+    }
+
+    VkPipelineStageFlags2 src_stage;
+    VkAccessFlags2 src_access;
+    if (Impl::barrier_for(state, stage, access, state.layout, src_stage, src_access)) {
+        _impl->pending_buffers[buffer.handle] = _impl->buffer_barriers.size();
+        _impl->buffer_barriers.push_back((VkBufferMemoryBarrier2) {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+            .srcStageMask = src_stage,
+            .srcAccessMask = src_access,
+            .dstStageMask = stage,
+            .dstAccessMask = access,
+            .buffer = buffer.handle,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE,
+        });
+    }
+    Impl::note_use(state, stage, access);
+}
+
+void BarrierBatcher::flush() {
+    if (_impl->image_barriers.empty() && _impl->buffer_barriers.empty())
+        return;
+    _impl->device.dispatch.cmdPipelineBarrier2KHR(_impl->cmdbuf, tmpPtr((VkDependencyInfo) {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .bufferMemoryBarrierCount = static_cast<uint32_t>(_impl->buffer_barriers.size()),
+        .pBufferMemoryBarriers = _impl->buffer_barriers.data(),
+        .imageMemoryBarrierCount = static_cast<uint32_t>(_impl->image_barriers.size()),
+        .pImageMemoryBarriers = _impl->image_barriers.data(),
+    }));
+    _impl->image_barriers.clear();
+    _impl->buffer_barriers.clear();
+    _impl->pending_images.clear();
+    _impl->pending_buffers.clear();
+}
+
+void BarrierBatcher::setCommandBuffer(VkCommandBuffer cmdbuf) {
+    flush();
+    _impl->cmdbuf = cmdbuf;
+}
+
+}
@@ -0,0 +1,192 @@
+#include "imr_private.h"
+
+#include <algorithm>
+
+namespace imr {
+
+static const uint32_t max_bindless_images = 16384;
+static const uint32_t max_bindless_samplers = 1024;
+/// Left out of the per-stage budget, for the pipelines' own descriptor sets
+static const uint32_t reserved_per_stage_resources = 64;
+
+BindlessHeap::BindlessHeap(Device& device) {
+    _impl = std::make_unique<Impl>(device);
+}
+
+BindlessHeap::Impl::Impl(Device& device) : device(device) {
+    VkPhysicalDeviceDescriptorIndexingProperties indexing_properties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES,
+    };
+    vkGetPhysicalDeviceProperties2(device.physical_device, tmpPtr((VkPhysicalDeviceProperties2) {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &indexing_properties,
+    }));
+    image_capacity = std::min({
+        max_bindless_images,
+        indexing_properties.maxDescriptorSetUpdateAfterBindStorageImages,
+        indexing_properties.maxDescriptorSetUpdateAfterBindSampledImages,
+        indexing_properties.maxPerStageDescriptorUpdateAfterBindStorageImages,
+        indexing_properties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+    });
+    sampler_capacity = std::min({
+        max_bindless_samplers,
+        indexing_properties.maxDescriptorSetUpdateAfterBindSamplers,
+        indexing_properties.maxPerStageDescriptorUpdateAfterBindSamplers,
+    });
+    // Each array fitting on its own isn't enough, all of them together count against the per-stage limit too.
+    // Every stage sees both image arrays, so those get the budget the samplers leave.
+    uint32_t per_stage = indexing_properties.maxPerStageUpdateAfterBindResources;
+    per_stage = per_stage > reserved_per_stage_resources ? per_stage - reserved_per_stage_resources : 0;
+    if (2ull * image_capacity + sampler_capacity > per_stage) {
+        sampler_capacity = std::min(sampler_capacity, per_stage / 8);
+        image_capacity = std::min(image_capacity, (per_stage - sampler_capacity) / 2);
+    }
+
+    VkDescriptorSetLayoutBinding bindings[] = {
+        {
+            .binding = storage_images_binding,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .descriptorCount = image_capacity,
+            .stageFlags = VK_SHADER_STAGE_ALL,
+        },
+        {
+            .binding = sampled_images_binding,
+            .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+            .descriptorCount = image_capacity,
+            .stageFlags = VK_SHADER_STAGE_ALL,
+        },
+        {
+            .binding = samplers_binding,
+            .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
+            .descriptorCount = sampler_capacity,
+            .stageFlags = VK_SHADER_STAGE_ALL,
+        },
+    };
+    // Slots are mostly empty, and get filled in while frames using other slots are in flight
+    VkDescriptorBindingFlags flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+    VkDescriptorBindingFlags binding_flags[] = { flags, flags, flags };
+
+    CHECK_VK_THROW(vkCreateDescriptorSetLayout(device.device, tmpPtr((VkDescriptorSetLayoutCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = tmpPtr((VkDescriptorSetLayoutBindingFlagsCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+            .bindingCount = 3,
+            .pBindingFlags = binding_flags,
+        }),
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+        .bindingCount = 3,
+        .pBindings = bindings,
+    }), nullptr, &layout));
+
+    VkDescriptorPoolSize sizes[] = {
+        { .type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, .descriptorCount = image_capacity },
+        { .type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, .descriptorCount = image_capacity },
+        { .type = VK_DESCRIPTOR_TYPE_SAMPLER, .descriptorCount = sampler_capacity },
+    };
+    CHECK_VK_THROW(vkCreateDescriptorPool(device.device, tmpPtr((VkDescriptorPoolCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+        .maxSets = 1,
+        .poolSizeCount = 3,
+        .pPoolSizes = sizes,
+    }), nullptr, &pool));
+
+    CHECK_VK_THROW(vkAllocateDescriptorSets(device.device, tmpPtr((VkDescriptorSetAllocateInfo) {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &layout,
+    }), &set));
+}
+
+BindlessHeap::Impl::~Impl() {
+    vkDestroyDescriptorPool(device.device, pool, nullptr);
+    vkDestroyDescriptorSetLayout(device.device, layout, nullptr);
+}
+
+BindlessHeap::~BindlessHeap() = default;
+
+uint32_t BindlessHeap::Impl::allocate_slot(std::vector<uint32_t>& free, uint32_t& next, uint32_t capacity) {
+    if (!free.empty()) {
+        uint32_t slot = free.back();
+        free.pop_back();
+        return slot;
+    }
+    if (next == capacity)
+        throw std::runtime_error("The bindless heap is full");
+    return next++;
+}
+
+void BindlessHeap::Impl::release_slot(std::vector<uint32_t>& free, uint32_t slot) {
+    // frames in flight might still be reading the slot, it can only be written to again once they're done
+    device.deferCleanup(device._impl->last_timeline_value, [&free, slot]() {
+        free.push_back(slot);
+    });
+}
+
+uint32_t BindlessHeap::Impl::add_image(VkImageView view, VkImageUsageFlags usage) {
+    uint32_t slot = allocate_slot(free_images, next_image, image_capacity);
+    VkDescriptorImageInfo image_info = {
+        .imageView = view,
+        .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+    };
+    std::vector<VkWriteDescriptorSet> writes;
+    auto write = [&](uint32_t binding, VkDescriptorType type) {
+        writes.push_back((VkWriteDescriptorSet) {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = set,
+            .dstBinding = binding,
+            .dstArrayElement = slot,
+            .descriptorCount = 1,
+            .descriptorType = type,
+            .pImageInfo = &image_info,
+        });
+    };
+    if (usage & VK_IMAGE_USAGE_STORAGE_BIT)
+        write(storage_images_binding, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    if (usage & VK_IMAGE_USAGE_SAMPLED_BIT)
+        write(sampled_images_binding, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE);
+    vkUpdateDescriptorSets(device.device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+    return slot;
+}
+
+void BindlessHeap::Impl::remove_image(uint32_t slot) {
+    release_slot(free_images, slot);
+}
+
+VkDescriptorSetLayout BindlessHeap::set_layout() const { return _impl->layout; }
+VkDescriptorSet BindlessHeap::descriptor_set() const { return _impl->set; }
+
+void BindlessHeap::bind(VkCommandBuffer cmdbuf, VkPipelineBindPoint bind_point, VkPipelineLayout pipeline_layout) {
+    vkCmdBindDescriptorSets(cmdbuf, bind_point, pipeline_layout, set, 1, &_impl->set, 0, nullptr);
+}
+
+uint32_t BindlessHeap::addSampler(VkSampler sampler) {
+    uint32_t slot = _impl->allocate_slot(_impl->free_samplers, _impl->next_sampler, _impl->sampler_capacity);
+    vkUpdateDescriptorSets(_impl->device.device, 1, tmpPtr((VkWriteDescriptorSet) {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = _impl->set,
+        .dstBinding = samplers_binding,
+        .dstArrayElement = slot,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
+        .pImageInfo = tmpPtr((VkDescriptorImageInfo) {
+            .sampler = sampler,
+        }),
+    }), 0, nullptr);
+    return slot;
+}
+
+void BindlessHeap::removeSampler(uint32_t index) {
+    _impl->release_slot(_impl->free_samplers, index);
+}
+
+BindlessHeap& Device::bindless() {
+    if (!bindless_supported)
+        throw std::runtime_error("Bindless descriptors need descriptor indexing, which this device lacks");
+    if (!_impl->bindless)
+        _impl->bindless = std::make_unique<BindlessHeap>(*this);
+    return *_impl->bindless;
+}
+
+}
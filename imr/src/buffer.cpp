@@ -9,6 +9,8 @@ struct Buffer::Impl {
 
     VmaAllocation allocation;
     VmaAllocationInfo allocation_info;
+
+    ResourceState state;
 };
 
 Buffer::Buffer(imr::Device& device, size_t size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memory_property) : size(size) {
@@ -21,7 +23,8 @@ Buffer::Buffer(imr::Device& device, size_t size, VkBufferUsageFlags usage, VkMem
         .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
     };
     VmaAllocationCreateInfo vma_aci = {
-        .flags = 0,
+        // VMA keeps host-visible memory mapped for as long as the allocation lives
+        .flags = (memory_property & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ? VMA_ALLOCATION_CREATE_MAPPED_BIT : 0u,
         .usage = VMA_MEMORY_USAGE_UNKNOWN,
         .requiredFlags = memory_property
     };
@@ -37,27 +40,40 @@ VkDeviceAddress Buffer::device_address() {
     }));
 }
 
+ResourceState& Buffer::state() { return _impl->state; }
+
+std::span<std::byte> Buffer::mapped() const {
+    auto data = static_cast<std::byte*>(_impl->allocation_info.pMappedData);
+    if (!data)
+        return {};
+    return { data, size };
+}
+
+void Buffer::flush(uint64_t offset, uint64_t size) {
+    CHECK_VK_THROW(vmaFlushAllocation(_impl->device._impl->allocator, _impl->allocation, offset, size));
+}
+
+void Buffer::invalidate(uint64_t offset, uint64_t size) {
+    CHECK_VK_THROW(vmaInvalidateAllocation(_impl->device._impl->allocator, _impl->allocation, offset, size));
+}
+
 void Buffer::uploadDataSync(uint64_t offset, uint64_t size, void* data) {
     auto& device = _impl->device;
     if (_impl->memory_property & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
-        void* mapped_buffer;
-        CHECK_VK_THROW(vkMapMemory(device.device, memory, memory_offset, size, 0, (void**) &mapped_buffer));
-        memcpy(mapped_buffer, data, size);
-        vkUnmapMemory(device.device, memory);
+        memcpy(mapped().data() + offset, data, size);
+        flush(offset, size);
     } else if (_impl->usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT) {
-        // TODO: be less ridiculous, import host memory
-        auto staging = imr::Buffer(device, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-        staging.uploadDataSync(0, size, data);
-
+        // executeCommandsSync gives the staging space back once the copy is done
         device.executeCommandsSync([&](VkCommandBuffer cmdbuf) {
+            auto [staging_buffer, staging_offset] = device._impl->staging_ring(device).stage(size, data);
             vkCmdCopyBuffer2(cmdbuf, tmpPtr((VkCopyBufferInfo2) {
                 .sType = VK_STRUCTURE_TYPE_COPY_BUFFER_INFO_2,
-                .srcBuffer = staging.handle,
+                .srcBuffer = staging_buffer,
                 .dstBuffer = handle,
                 .regionCount = 1,
                 .pRegions = tmpPtr((VkBufferCopy2) {
                     .sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2,
-                    .srcOffset = 0,
+                    .srcOffset = staging_offset,
                     .dstOffset = offset,
                     .size = size,
                 })
@@ -68,6 +84,32 @@ void Buffer::uploadDataSync(uint64_t offset, uint64_t size, void* data) {
     }
 }
 
+void Buffer::uploadDataAsync(VkCommandBuffer cmdbuf, uint64_t offset, uint64_t size, void* data) {
+    auto& device = _impl->device;
+    if (!(_impl->usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT))
+        throw std::runtime_error("Error: This buffer was allocated without VK_BUFFER_USAGE_TRANSFER_DST_BIT, we cannot copy to it!");
+
+    auto [staging_buffer, staging_offset] = device._impl->staging_ring(device).stage(size, data);
+
+    // Waits for what the state says still uses the previous contents, and leaves the copy in there for whoever reads the new ones
+    BarrierBatcher barriers(device, cmdbuf);
+    barriers.require(*this, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+    barriers.flush();
+
+    vkCmdCopyBuffer2(cmdbuf, tmpPtr((VkCopyBufferInfo2) {
+        .sType = VK_STRUCTURE_TYPE_COPY_BUFFER_INFO_2,
+        .srcBuffer = staging_buffer,
+        .dstBuffer = handle,
+        .regionCount = 1,
+        .pRegions = tmpPtr((VkBufferCopy2) {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2,
+            .srcOffset = staging_offset,
+            .dstOffset = offset,
+            .size = size,
+        })
+    }));
+}
+
 Buffer::~Buffer() {
     vmaDestroyBuffer(_impl->device._impl->allocator, handle, _impl->allocation);
 }
@@ -0,0 +1,67 @@
+#include "imr_private.h"
+
+#include <algorithm>
+#include <optional>
+
+namespace imr {
+
+CompileThreads::CompileThreads() {
+    // leave a core to the render thread
+    unsigned count = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    for (unsigned i = 0; i < count; i++)
+        threads.emplace_back([this]() { work(); });
+}
+
+CompileThreads::~CompileThreads() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+        jobs.clear();
+    }
+    wake.notify_all();
+    for (auto& thread : threads)
+        thread.join();
+}
+
+void CompileThreads::enqueue(std::function<void(void)>&& job) {
+    {
+        std::lock_guard lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    wake.notify_one();
+}
+
+void CompileThreads::work() {
+    while (true) {
+        std::function<void(void)> job;
+        {
+            std::unique_lock lock(mutex);
+            wake.wait(lock, [&]() { return stopping || !jobs.empty(); });
+            if (stopping)
+                return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        job();
+    }
+}
+
+/// Device::use_descriptor_buffers as it was when the job running on this thread was queued, the render loop may have flipped it since
+static thread_local std::optional<bool> queued_use_descriptor_buffers;
+
+void Device::runOnCompileThread(std::function<void(void)>&& job) {
+    if (!_impl->compile_threads)
+        _impl->compile_threads = std::make_unique<CompileThreads>();
+    bool descriptor_buffers = use_descriptor_buffers;
+    _impl->compile_threads->enqueue([descriptor_buffers, job = std::move(job)]() {
+        queued_use_descriptor_buffers = descriptor_buffers;
+        job();
+        queued_use_descriptor_buffers.reset();
+    });
+}
+
+bool Device::Impl::use_descriptor_buffers(Device& device) {
+    return queued_use_descriptor_buffers.value_or(device.use_descriptor_buffers);
+}
+
+}
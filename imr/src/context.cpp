@@ -11,6 +11,12 @@ Context::Context(std::function<void(vkb::InstanceBuilder&)>&& instance_custom) {
         //.enable_extension("VK_EXT_surface_maintenance1")
         .require_api_version(1, 3, 0);
 
+    // Lets us create a Swapchain without a window, for machines that don't have a display at all
+    if (auto system_info = vkb::SystemInfo::get_system_info(); system_info.has_value() && system_info->is_extension_available("VK_EXT_headless_surface")) {
+        instance_builder.enable_extension("VK_EXT_headless_surface");
+        headless_surface_supported = true;
+    }
+
     instance_custom(instance_builder);
 
     if (auto built = instance_builder
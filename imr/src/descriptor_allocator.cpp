@@ -0,0 +1,123 @@
+#include "imr_private.h"
+
+#include <algorithm>
+
+namespace imr {
+
+static const uint32_t sets_per_pool = 256;
+static const uint32_t descriptors_per_type = 1024;
+
+DescriptorAllocator::DescriptorAllocator(Device& device) : device(device) {
+    // enough for what the bind helpers usually ask for, the rest is added once a layout needs it
+    for (auto type : { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, VK_DESCRIPTOR_TYPE_SAMPLER, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER })
+        pool_sizes[type] = descriptors_per_type;
+}
+
+DescriptorAllocator::~DescriptorAllocator() {
+    for (auto& pool : pools)
+        vkDestroyDescriptorPool(device.device, pool->pool, nullptr);
+}
+
+DescriptorAllocator::Pool* DescriptorAllocator::next_pool() {
+    while (!free_pools.empty()) {
+        auto pool = free_pools.back();
+        free_pools.pop_back();
+        if (pool->sizes_generation == sizes_generation)
+            return pool;
+        destroy(pool);
+    }
+
+    // one size fits all, the bind helpers only ever ask for a handful of sets each
+    std::vector<VkDescriptorPoolSize> sizes;
+    for (auto [type, count] : pool_sizes) {
+        sizes.push_back((VkDescriptorPoolSize) {
+            .type = type,
+            .descriptorCount = count,
+        });
+    }
+    auto pool = std::make_unique<Pool>();
+    pool->sizes_generation = sizes_generation;
+    CHECK_VK_THROW(vkCreateDescriptorPool(device.device, tmpPtr((VkDescriptorPoolCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = sets_per_pool,
+        .poolSizeCount = static_cast<uint32_t>(sizes.size()),
+        .pPoolSizes = sizes.data(),
+    }), nullptr, &pool->pool));
+    pools.push_back(std::move(pool));
+    return pools.back().get();
+}
+
+DescriptorAllocator::Allocation DescriptorAllocator::allocate(VkDescriptorSetLayout layout, const std::vector<VkDescriptorPoolSize>& sizes) {
+    // The pools so far have no room for this layout at all, the next ones will
+    bool grown = false;
+    for (auto size : sizes) {
+        auto& count = pool_sizes[size.type];
+        if (count < size.descriptorCount) {
+            count = std::max(size.descriptorCount, descriptors_per_type);
+            grown = true;
+        }
+    }
+    if (grown) {
+        sizes_generation++;
+        if (current) {
+            Pool* old = current;
+            current = nullptr;
+            if (old->live_sets == 0)
+                destroy(old);
+        }
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (!current)
+            current = next_pool();
+
+        VkDescriptorSet set;
+        VkResult result = vkAllocateDescriptorSets(device.device, tmpPtr((VkDescriptorSetAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .descriptorPool = current->pool,
+            .descriptorSetCount = 1,
+            .pSetLayouts = &layout,
+        }), &set);
+        if (result == VK_SUCCESS) {
+            current->live_sets++;
+            return { set, current };
+        }
+        if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL)
+            CHECK_VK_THROW(result);
+
+        // The pool is full, move on to another one. This one gets reset once all its sets are given back.
+        Pool* full = current;
+        current = nullptr;
+        if (full->live_sets == 0)
+            recycle(full);
+    }
+    throw std::runtime_error("Descriptor set doesn't fit in an empty pool");
+}
+
+void DescriptorAllocator::release(Allocation allocation) {
+    auto pool = allocation.pool;
+    assert(pool->live_sets > 0);
+    pool->live_sets--;
+    if (pool->live_sets == 0 && pool != current)
+        recycle(pool);
+}
+
+void DescriptorAllocator::recycle(Pool* pool) {
+    if (pool->sizes_generation != sizes_generation)
+        return destroy(pool);
+    CHECK_VK_THROW(vkResetDescriptorPool(device.device, pool->pool, 0));
+    free_pools.push_back(pool);
+}
+
+void DescriptorAllocator::destroy(Pool* pool) {
+    vkDestroyDescriptorPool(device.device, pool->pool, nullptr);
+    std::erase_if(pools, [&](auto& owned) { return owned.get() == pool; });
+}
+
+DescriptorAllocator& Device::Impl::descriptor_allocator(Device& device) {
+    if (!descriptors)
+        descriptors = std::make_unique<DescriptorAllocator>(device);
+    return *descriptors;
+}
+
+}
@@ -1,5 +1,8 @@
 #include "shader_private.h"
 
+#include <cstring>
+#include <set>
+
 namespace imr {
 
 struct DescriptorBindHelper::Impl {
@@ -8,69 +11,70 @@ struct DescriptorBindHelper::Impl {
     ReflectedLayout& reflected;
     VkPipelineBindPoint bind_point;
 
-    unsigned nsets;
-    VkDescriptorSet* sets;
-    VkDescriptorPool pool;
+    /// Allocated lazily, from the device's descriptor allocator
+    std::vector<DescriptorAllocator::Allocation> sets;
+
+    /// Writes are staged per set and applied all at once by commit()
+    struct StagedSet {
+        std::vector<VkWriteDescriptorSet> writes;
+        /// What the writes point to, a deque so that doesn't move
+        std::deque<VkDescriptorImageInfo> images;
+        /// The same descriptors, laid out for the set's update template
+        std::vector<std::byte> template_data;
+        std::set<uint32_t> template_bindings;
+    };
+    std::vector<StagedSet> staged;
+
+    /// With PipelineLayout::descriptor_buffer, where the descriptors of all the sets go instead, allocated on first use
+    std::optional<DescriptorBufferAllocator::Allocation> descriptor_range;
 
-    std::vector<std::function<void(void)>> cleanup;
     bool committed = false;
 
     Impl(Device& device, PipelineLayout& layout, ReflectedLayout& reflected, VkPipelineBindPoint bind_point) : device(device), layout(layout), reflected(reflected), bind_point(bind_point) {
-        auto& vk = device.dispatch;
-        nsets = reflected.set_bindings.size();
-
-        std::unordered_map<VkDescriptorType, uint32_t> descriptor_counts;
-        auto access_map = [&](VkDescriptorType key) -> uint32_t& {
-            if (descriptor_counts.contains(key))
-                return descriptor_counts[key];
-            return descriptor_counts[key] = 0;
-        };
-        for (auto& [set, bindings] : reflected.set_bindings) {
-            for (auto& binding : bindings) {
-                access_map(binding.descriptorType) += binding.descriptorCount;
-            }
-        }
+        sets.resize(layout.set_layouts.size());
+        staged.resize(layout.set_layouts.size());
+    }
 
-        std::vector<VkDescriptorPoolSize> pool_sizes;
-        for (auto& [type, count] : descriptor_counts) {
-            VkDescriptorPoolSize size = {
-                .type = type,
-                .descriptorCount = count,
-            };
-            pool_sizes.push_back(size);
-        }
+    void stage(unsigned set, VkWriteDescriptorSet write, VkDescriptorImageInfo image_info) {
+        auto& staged_set = staged[set];
+        write.pImageInfo = &staged_set.images.emplace_back(image_info);
+        staged_set.writes.push_back(write);
 
-        vkCreateDescriptorPool(vk.device, tmpPtr((VkDescriptorPoolCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-            .flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
-            .maxSets = static_cast<uint32_t>(layout.set_layouts.size()),
-            .poolSizeCount = static_cast<uint32_t>(pool_sizes.size()),
-            .pPoolSizes = pool_sizes.data(),
-        }), nullptr, &pool);
+        auto& update_template = layout.update_templates[set];
+        if (auto found = update_template.binding_offsets.find(write.dstBinding); found != update_template.binding_offsets.end()) {
+            staged_set.template_data.resize(update_template.data_size);
+            memcpy(staged_set.template_data.data() + found->second, &image_info, sizeof(image_info));
+            staged_set.template_bindings.insert(write.dstBinding);
+        }
+    }
 
-        sets = reinterpret_cast<VkDescriptorSet*>(calloc(nsets, sizeof(VkDescriptorSet)));
+    // Templates write every binding of the set, so they're only good once all of them were staged
+    bool can_use_template(unsigned set) {
+        auto& update_template = layout.update_templates[set];
+        return update_template.handle && staged[set].template_bindings.size() == update_template.binding_offsets.size();
     }
 
     // Lazily allocates the set if we need it
     VkDescriptorSet get_or_create_set(unsigned set) {
-        if (sets[set] == 0) {
-            CHECK_VK_THROW(vkAllocateDescriptorSets(device.device, tmpPtr((VkDescriptorSetAllocateInfo) {
-                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-                .descriptorPool = pool,
-                .descriptorSetCount = 1,
-                .pSetLayouts = &layout.set_layouts[set],
-            }), &sets[set]));
-        }
-        return sets[set];
+        if (!sets[set].set)
+            sets[set] = device._impl->descriptor_allocator(device).allocate(layout.set_layouts[set], layout.set_pool_sizes[set]);
+        return sets[set].set;
     }
 
-    ~Impl() {
-        free(sets);
-        vkDestroyDescriptorPool(device.device, pool, nullptr);
+    // Same, for the descriptor buffer path, returns where the set's descriptors go in host memory
+    std::byte* get_or_create_set_memory(unsigned set) {
+        if (!descriptor_range)
+            descriptor_range = device._impl->descriptor_buffer_allocator(device).allocate(layout.descriptor_buffer_size);
+        return descriptor_range->block->buffer->mapped().data() + descriptor_range->offset + layout.set_offsets[set];
+    }
 
-        for (auto& fn : cleanup) {
-            fn();
+    ~Impl() {
+        for (auto& allocation : sets) {
+            if (allocation.set)
+                device._impl->descriptor_allocator(device).release(allocation);
         }
+        if (descriptor_range)
+            device._impl->descriptor_buffer_allocator(device).release(*descriptor_range);
     }
 };
 
@@ -81,7 +85,7 @@ DescriptorBindHelper::DescriptorBindHelper(std::unique_ptr<imr::DescriptorBindHe
 DescriptorBindHelper::~DescriptorBindHelper() {}
 
 DescriptorBindHelper* ComputePipeline::create_bind_helper() {
-    auto impl = std::make_unique<DescriptorBindHelper::Impl>(_impl->device, *_impl->layout, *_impl->entry_point->_impl->reflected, VK_PIPELINE_BIND_POINT_COMPUTE);
+    auto impl = std::make_unique<DescriptorBindHelper::Impl>(_impl->device, *_impl->layout, *_impl->shader._impl->reflected, VK_PIPELINE_BIND_POINT_COMPUTE);
     return new DescriptorBindHelper(std::move(impl));
 }
 
@@ -90,55 +94,89 @@ DescriptorBindHelper* GraphicsPipeline::create_bind_helper() {
     return new DescriptorBindHelper(std::move(impl));
 }
 
-VkImageViewType image_type_to_view_type(VkImageType type) {
-    switch (type) {
-        case VK_IMAGE_TYPE_1D: return VK_IMAGE_VIEW_TYPE_1D;
-        case VK_IMAGE_TYPE_2D: return VK_IMAGE_VIEW_TYPE_2D;
-        case VK_IMAGE_TYPE_3D: return VK_IMAGE_VIEW_TYPE_3D;
-        default: throw std::runtime_error("Unknown image type");
-    }
-}
-
 void DescriptorBindHelper::set_storage_image(uint32_t set, uint32_t binding, Image& image, std::optional<VkImageSubresourceRange> subresource, std::optional<VkImageViewType> image_view_type) {
     assert(!_impl->committed);
+    assert(!(_impl->layout.bindless && set == BindlessHeap::set) && "that set is the bindless heap, use Image::bindless_index() instead");
     auto& device = _impl->device;
 
-    VkImageViewType final_image_view_type = image_view_type ? *image_view_type : image_type_to_view_type(image.type());
-    VkImageSubresourceRange subresource_range = subresource ? *subresource : image.whole_image_subresource_range();
-
-    VkImageView view;
-    vkCreateImageView(device.device, tmpPtr((VkImageViewCreateInfo) {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-        .image = image.handle(),
-        .viewType = final_image_view_type,
-        .format = image.format(),
-        .subresourceRange = subresource_range,
-    }), nullptr, &view);
+    // the image keeps its views around, binding the same image again is cheap
+    VkImageView view = image.view(image_view_type, subresource);
+
+    if (_impl->layout.descriptor_buffer) {
+        // writing the descriptor is all it takes, no set to update
+        VkDeviceSize binding_offset;
+        device.dispatch.getDescriptorSetLayoutBindingOffsetEXT(_impl->layout.set_layouts[set], binding, &binding_offset);
+        device.dispatch.getDescriptorEXT(tmpPtr((VkDescriptorGetInfoEXT) {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT,
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .data = {
+                .pStorageImage = tmpPtr((VkDescriptorImageInfo) {
+                    .sampler = VK_NULL_HANDLE,
+                    .imageView = view,
+                    .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+                }),
+            },
+        }), device._impl->descriptor_buffer_properties.storageImageDescriptorSize, _impl->get_or_create_set_memory(set) + binding_offset);
+        return;
+    }
 
-    vkUpdateDescriptorSets(device.device, 1, tmpPtr((VkWriteDescriptorSet) {
+    _impl->stage(set, (VkWriteDescriptorSet) {
         .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-        .dstSet = _impl->get_or_create_set(set),
         .dstBinding = binding,
         .descriptorCount = 1,
         .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-        .pImageInfo = tmpPtr((VkDescriptorImageInfo) {
-            .sampler = VK_NULL_HANDLE,
-            .imageView = view,
-            .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
-        }),
-    }), 0, nullptr);
-
-    auto deviceHandle = device.device.device;
-    _impl->cleanup.push_back([=]() {
-        vkDestroyImageView(deviceHandle, view, nullptr);
+    }, (VkDescriptorImageInfo) {
+        .sampler = VK_NULL_HANDLE,
+        .imageView = view,
+        .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
     });
 }
 
 void DescriptorBindHelper::commit(VkCommandBuffer cmdbuf) {
-    assert(!_impl->committed);
-    for (unsigned set = 0; set < _impl->nsets; set++) {
-        if (_impl->sets[set])
-            vkCmdBindDescriptorSets(cmdbuf, _impl->bind_point, _impl->layout.pipeline_layout, set, 1, &_impl->sets[set], 0, nullptr);
+    auto& device = _impl->device;
+    auto& layout = _impl->layout;
+
+    // The sets are only written the first time, before they're ever bound
+    for (unsigned set = 0; set < _impl->staged.size() && !_impl->committed; set++) {
+        auto& staged = _impl->staged[set];
+        if (staged.writes.empty() || layout.push_set == set)
+            continue;
+        VkDescriptorSet descriptor_set = _impl->get_or_create_set(set);
+        if (_impl->can_use_template(set)) {
+            vkUpdateDescriptorSetWithTemplate(device.device, descriptor_set, layout.update_templates[set].handle, staged.template_data.data());
+            continue;
+        }
+        for (auto& write : staged.writes)
+            write.dstSet = descriptor_set;
+        vkUpdateDescriptorSets(device.device, static_cast<uint32_t>(staged.writes.size()), staged.writes.data(), 0, nullptr);
+    }
+
+    // Binding the sets into more command buffers is fine, updating them once they're bound isn't
+    for (unsigned set = 0; set < _impl->sets.size(); set++) {
+        if (_impl->sets[set].set)
+            vkCmdBindDescriptorSets(cmdbuf, _impl->bind_point, layout.pipeline_layout, set, 1, &_impl->sets[set].set, 0, nullptr);
+    }
+    if (auto& range = _impl->descriptor_range) {
+        device.dispatch.cmdBindDescriptorBuffersEXT(cmdbuf, 1, tmpPtr((VkDescriptorBufferBindingInfoEXT) {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT,
+            .address = range->block->address,
+            .usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT,
+        }));
+        std::vector<uint32_t> buffer_indices(layout.set_layouts.size(), 0);
+        std::vector<VkDeviceSize> offsets;
+        for (auto set_offset : layout.set_offsets)
+            offsets.push_back(range->offset + set_offset);
+        device.dispatch.cmdSetDescriptorBufferOffsetsEXT(cmdbuf, _impl->bind_point, layout.pipeline_layout, 0, static_cast<uint32_t>(offsets.size()), buffer_indices.data(), offsets.data());
+    }
+    if (layout.bindless)
+        layout.bindless->bind(cmdbuf, _impl->bind_point, layout.pipeline_layout);
+    // The pushed set goes into every command buffer
+    if (auto set = layout.push_set; set && !_impl->staged[*set].writes.empty()) {
+        auto& staged = _impl->staged[*set];
+        if (_impl->can_use_template(*set))
+            device.dispatch.cmdPushDescriptorSetWithTemplateKHR(cmdbuf, layout.update_templates[*set].handle, layout.pipeline_layout, *set, staged.template_data.data());
+        else
+            device.dispatch.cmdPushDescriptorSetKHR(cmdbuf, _impl->bind_point, layout.pipeline_layout, *set, static_cast<uint32_t>(staged.writes.size()), staged.writes.data());
     }
     _impl->committed = true;
 }
@@ -0,0 +1,67 @@
+#include "imr_private.h"
+
+namespace imr {
+
+static const VkDeviceSize descriptor_block_size = 1024 * 1024;
+
+DescriptorBufferAllocator::DescriptorBufferAllocator(Device& device) : device(device) {}
+
+DescriptorBufferAllocator::~DescriptorBufferAllocator() = default;
+
+DescriptorBufferAllocator::Block* DescriptorBufferAllocator::next_block() {
+    if (!free_blocks.empty()) {
+        auto block = free_blocks.back();
+        free_blocks.pop_back();
+        block->used = 0;
+        return block;
+    }
+
+    // the bind helpers write the descriptors from the CPU, coherent memory saves flushing after each one
+    auto block = std::make_unique<Block>();
+    block->buffer = std::make_unique<Buffer>(device, descriptor_block_size, VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    block->address = block->buffer->device_address();
+    blocks.push_back(std::move(block));
+    return blocks.back().get();
+}
+
+DescriptorBufferAllocator::Allocation DescriptorBufferAllocator::allocate(VkDeviceSize size) {
+    VkDeviceSize alignment = device._impl->descriptor_buffer_properties.descriptorBufferOffsetAlignment;
+    if (size > descriptor_block_size)
+        throw std::runtime_error("Descriptors don't fit in a descriptor buffer block");
+
+    if (current) {
+        VkDeviceSize offset = (current->used + alignment - 1) / alignment * alignment;
+        if (offset + size <= descriptor_block_size) {
+            current->used = offset + size;
+            current->live_ranges++;
+            return { current, offset };
+        }
+
+        // The block is full, it gets reused once all its ranges are given back
+        Block* full = current;
+        current = nullptr;
+        if (full->live_ranges == 0)
+            free_blocks.push_back(full);
+    }
+
+    current = next_block();
+    current->used = size;
+    current->live_ranges++;
+    return { current, 0 };
+}
+
+void DescriptorBufferAllocator::release(Allocation allocation) {
+    auto block = allocation.block;
+    assert(block->live_ranges > 0);
+    block->live_ranges--;
+    if (block->live_ranges == 0 && block != current)
+        free_blocks.push_back(block);
+}
+
+DescriptorBufferAllocator& Device::Impl::descriptor_buffer_allocator(Device& device) {
+    if (!descriptor_buffers)
+        descriptor_buffers = std::make_unique<DescriptorBufferAllocator>(device);
+    return *descriptor_buffers;
+}
+
+}
@@ -21,6 +21,10 @@ static auto make_default_device_selector(Context& context) {
             .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES,
             .bufferDeviceAddress = true,
         })
+        .add_required_extension_features((VkPhysicalDeviceTimelineSemaphoreFeatures) {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+            .timelineSemaphore = true,
+        })
         .add_required_extension_features((VkPhysicalDeviceSynchronization2FeaturesKHR) {
             .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR,
             .pNext = nullptr,
@@ -54,7 +58,68 @@ Device::Device(Context& context, std::function<void(vkb::PhysicalDeviceSelector&
 Device::Device(imr::Context& context, vkb::PhysicalDevice physical_device) : context(context), physical_device(physical_device) {
     _impl = std::make_unique<Impl>();
 
-    if (auto built = vkb::DeviceBuilder(physical_device)
+    // Optional extensions, we make do without them
+    _impl->present_wait_supported = this->physical_device.enable_extension_if_present("VK_KHR_present_id")
+        && this->physical_device.enable_extension_if_present("VK_KHR_present_wait")
+        && this->physical_device.enable_extension_features_if_present((VkPhysicalDevicePresentIdFeaturesKHR) {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+            .presentId = true,
+        })
+        && this->physical_device.enable_extension_features_if_present((VkPhysicalDevicePresentWaitFeaturesKHR) {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR,
+            .presentWait = true,
+        });
+
+    // For the BindlessHeap
+    bindless_supported = this->physical_device.enable_extension_features_if_present((VkPhysicalDeviceDescriptorIndexingFeatures) {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES,
+        .shaderSampledImageArrayNonUniformIndexing = true,
+        .shaderStorageImageArrayNonUniformIndexing = true,
+        .descriptorBindingSampledImageUpdateAfterBind = true,
+        .descriptorBindingStorageImageUpdateAfterBind = true,
+        .descriptorBindingUpdateUnusedWhilePending = true,
+        .descriptorBindingPartiallyBound = true,
+        .runtimeDescriptorArray = true,
+    });
+
+    // Lets the bind helpers write small descriptor sets straight into the command buffer
+    if (this->physical_device.enable_extension_if_present("VK_KHR_push_descriptor")) {
+        VkPhysicalDevicePushDescriptorPropertiesKHR push_descriptor_properties = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PUSH_DESCRIPTOR_PROPERTIES_KHR,
+        };
+        vkGetPhysicalDeviceProperties2(this->physical_device, tmpPtr((VkPhysicalDeviceProperties2) {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &push_descriptor_properties,
+        }));
+        _impl->max_push_descriptors = push_descriptor_properties.maxPushDescriptors;
+    }
+
+    // Lets the GpuProfiler reset its queries once it has read them, without a command buffer
+    _impl->host_query_reset_supported = this->physical_device.enable_extension_features_if_present((VkPhysicalDeviceHostQueryResetFeatures) {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_QUERY_RESET_FEATURES,
+        .hostQueryReset = true,
+    });
+
+    // Lets the Tracer put GPU timestamps on the CPU timeline
+    _impl->calibrated_timestamps_supported = this->physical_device.enable_extension_if_present("VK_EXT_calibrated_timestamps");
+
+    // An alternative to descriptor sets, see Device::use_descriptor_buffers
+    descriptor_buffer_supported = this->physical_device.enable_extension_if_present("VK_EXT_descriptor_buffer")
+        && this->physical_device.enable_extension_features_if_present((VkPhysicalDeviceDescriptorBufferFeaturesEXT) {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT,
+            .descriptorBuffer = true,
+        });
+    if (descriptor_buffer_supported) {
+        _impl->descriptor_buffer_properties = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_PROPERTIES_EXT,
+        };
+        vkGetPhysicalDeviceProperties2(this->physical_device, tmpPtr((VkPhysicalDeviceProperties2) {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &_impl->descriptor_buffer_properties,
+        }));
+    }
+
+    if (auto built = vkb::DeviceBuilder(this->physical_device)
             .build(); built.has_value())
     {
         device = built.value();
@@ -64,11 +129,50 @@ Device::Device(imr::Context& context, vkb::PhysicalDevice physical_device) : con
     main_queue_idx = device.get_queue_index(vkb::QueueType((int) vkb::QueueType::graphics | (int) vkb::QueueType::present)).value();
     main_queue = device.get_queue(vkb::QueueType((int) vkb::QueueType::graphics | (int) vkb::QueueType::present)).value();
 
+    // Uploads can overlap with rendering if there's a transfer-only queue family
+    transfer_queue_idx = main_queue_idx;
+    if (auto transfer_idx = device.get_dedicated_queue_index(vkb::QueueType::transfer); transfer_idx.has_value()) {
+        transfer_queue_idx = transfer_idx.value();
+        transfer_queue = device.get_dedicated_queue(vkb::QueueType::transfer).value();
+    }
+
+    // Likewise for compute work, which can run alongside graphics work on its own queue
+    compute_queue_idx = main_queue_idx;
+    if (auto compute_idx = device.get_separate_queue_index(vkb::QueueType::compute); compute_idx.has_value()) {
+        compute_queue_idx = compute_idx.value();
+        compute_queue = device.get_separate_queue(vkb::QueueType::compute).value();
+    }
+
     CHECK_VK(vkCreateCommandPool(device, tmpPtr((VkCommandPoolCreateInfo) {
         .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
         .queueFamilyIndex = main_queue_idx,
     }), nullptr, &pool), throw std::runtime_error("failed to create cmdpool"));
 
+    CHECK_VK(vkCreateCommandPool(device, tmpPtr((VkCommandPoolCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .queueFamilyIndex = compute_queue_idx,
+    }), nullptr, &compute_pool), throw std::runtime_error("failed to create compute cmdpool"));
+
+    CHECK_VK(vkCreateSemaphore(device, tmpPtr((VkSemaphoreCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = tmpPtr((VkSemaphoreTypeCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+            .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+            .initialValue = 0,
+        }),
+    }), nullptr, &timeline), throw std::runtime_error("failed to create timeline semaphore"));
+
+    CHECK_VK(vkCreateSemaphore(device, tmpPtr((VkSemaphoreCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = tmpPtr((VkSemaphoreTypeCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+            .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+            .initialValue = 0,
+        }),
+    }), nullptr, &_impl->compute_timeline), throw std::runtime_error("failed to create compute timeline semaphore"));
+
+    _impl->load_pipeline_cache(*this);
+
     CHECK_VK(vmaCreateAllocator(tmpPtr((VmaAllocatorCreateInfo) {
         .flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT,
         .physicalDevice = physical_device,
@@ -78,10 +182,24 @@ Device::Device(imr::Context& context, vkb::PhysicalDevice physical_device) : con
 }
 
 Device::~Device() {
+    // lets builds in progress finish, they might still be using the device
+    _impl->compile_threads.reset();
     vkDeviceWaitIdle(device);
 
+    // everything is idle, so this retires all the deferred cleanup
+    collectGarbage();
+    vkDestroySemaphore(device, timeline, nullptr);
+    vkDestroySemaphore(device, _impl->compute_timeline, nullptr);
+    _impl->destroy_sync_pools(*this);
+    _impl->staging.reset();
+    _impl->descriptors.reset();
+    _impl->descriptor_buffers.reset();
+    _impl->bindless.reset();
     vmaDestroyAllocator(_impl->allocator);
     vkDestroyCommandPool(device, pool, nullptr);
+    vkDestroyCommandPool(device, compute_pool, nullptr);
+    _impl->save_pipeline_cache(*this);
+    vkDestroyPipelineCache(device, pipeline_cache, nullptr);
     vkb::destroy_device(device);
     _impl.reset();
 }
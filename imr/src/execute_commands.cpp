@@ -15,29 +15,33 @@ void Device::executeCommandsSync(std::function<void(VkCommandBuffer)> lambda) {
         .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
     }));
 
+    // Uploads staged while recording went into this command buffer
+    StagingRing::Mark staged_before = _impl->staging ? _impl->staging->mark() : 0;
     lambda(cmdbuf);
 
-    VkFence fence;
-    vkCreateFence(device.device, tmpPtr((VkFenceCreateInfo) {
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-        .flags = 0,
-    }), nullptr, &fence);
+    uint64_t timeline_value = nextTimelineValue();
 
     vkEndCommandBuffer(cmdbuf);
     vkQueueSubmit(main_queue, 1, tmpPtr((VkSubmitInfo) {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = tmpPtr((VkTimelineSemaphoreSubmitInfo) {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .signalSemaphoreValueCount = 1,
+            .pSignalSemaphoreValues = &timeline_value,
+        }),
         .waitSemaphoreCount = 0,
         .pWaitSemaphores = nullptr,
         .pWaitDstStageMask = tmpPtr((VkPipelineStageFlags) VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT),
         .commandBufferCount = 1,
         .pCommandBuffers = &cmdbuf,
-        .signalSemaphoreCount = 0,
-        .pSignalSemaphores = nullptr,
-    }), fence);
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &timeline,
+    }), VK_NULL_HANDLE);
 
-    vkWaitForFences(device, 1, &fence, true, UINT64_MAX);
+    waitForTimelineValue(timeline_value);
+    if (_impl->staging)
+        _impl->staging->retire(staged_before, _impl->staging->mark(), timeline_value);
 
-    vkDestroyFence(device.device, fence, nullptr);
     vkFreeCommandBuffers(device.device, pool, 1, &cmdbuf);
 }
 
@@ -1,7 +1,9 @@
 #include "imr_private.h"
 #include "imr/util.h"
 
-#include <iostream>
+#include <algorithm>
+#include <array>
+#include <cinttypes>
 
 namespace imr {
 
@@ -11,6 +13,21 @@ struct FpsCounter::Impl {
 
     int fps;
     float avg_frametime;
+
+    /// A ring of the last frame times in seconds, written by tick() and nothing else
+    std::array<float, history_size> history;
+    /// Frame times recorded so far, the next one goes to history[recorded % history_size]
+    uint64_t recorded = 0;
+    uint64_t last_tick = 0;
+
+    /// Kept around so updating the percentiles doesn't allocate
+    std::array<float, history_size> sorted;
+    Percentiles percentiles = {};
+    Histogram histogram = {};
+
+    char title[128];
+
+    void update_percentiles();
 };
 
 FpsCounter::FpsCounter() {
@@ -19,8 +36,46 @@ FpsCounter::FpsCounter() {
 
 FpsCounter::~FpsCounter() = default;
 
+void FpsCounter::Impl::update_percentiles() {
+    size_t count = std::min<uint64_t>(recorded, history_size);
+    if (count == 0)
+        return;
+    std::copy_n(history.begin(), count, sorted.begin());
+    std::sort(sorted.begin(), sorted.begin() + count);
+
+    auto percentile = [&](float p) {
+        return sorted[std::min(count - 1, static_cast<size_t>(p * count))];
+    };
+    percentiles.p50 = percentile(0.50f);
+    percentiles.p95 = percentile(0.95f);
+    percentiles.p99 = percentile(0.99f);
+    percentiles.max = sorted[count - 1];
+
+    size_t slowest = std::max<size_t>(1, count / 100);
+    float total = 0;
+    for (size_t i = count - slowest; i < count; i++)
+        total += sorted[i];
+    percentiles.one_percent_low_fps = total > 0 ? slowest / total : 0;
+
+    // they're sorted, so each bucket picks up where the last one stopped
+    size_t bucket = 0;
+    histogram = {};
+    for (size_t i = 0; i < count; i++) {
+        while (bucket < histogram_bounds.size() && sorted[i] * 1000.0f > histogram_bounds[bucket])
+            bucket++;
+        histogram[bucket]++;
+    }
+}
+
 void FpsCounter::tick() {
     uint64_t now = imr_get_time_nano();
+
+    if (_impl->last_tick != 0) {
+        _impl->history[_impl->recorded % history_size] = (now - _impl->last_tick) / 1000000000.0f;
+        _impl->recorded++;
+    }
+    _impl->last_tick = now;
+
     uint64_t delta = now - _impl->last_epoch;
     if (delta > 1000000000 /* 1 second */) {
         _impl->last_epoch = now;
@@ -29,8 +84,7 @@ void FpsCounter::tick() {
             _impl->avg_frametime = (delta / 1000000000.0f /* scale to seconds */) / _impl->frames_since_last_epoch;
         }
         _impl->frames_since_last_epoch = 0;
-
-        //std::cout << average_fps() << ", " << average_frametime() * 1000.0f << "\n";
+        _impl->update_percentiles();
     }
     _impl->frames_since_last_epoch++;
 }
@@ -43,13 +97,26 @@ float FpsCounter::average_frametime() {
     return _impl->avg_frametime;
 }
 
+FpsCounter::Percentiles FpsCounter::percentiles() {
+    return _impl->percentiles;
+}
+
+FpsCounter::Histogram FpsCounter::histogram() {
+    return _impl->histogram;
+}
+
+void FpsCounter::dumpCsv(FILE* file) {
+    uint64_t count = std::min<uint64_t>(_impl->recorded, history_size);
+    fprintf(file, "frame,frametime_ms\n");
+    for (uint64_t frame = _impl->recorded - count; frame < _impl->recorded; frame++)
+        fprintf(file, "%" PRIu64 ",%f\n", frame, _impl->history[frame % history_size] * 1000.0f);
+}
+
 void FpsCounter::updateGlfwWindowTitle(GLFWwindow* window) {
-    std::string str = "Fps: ";
-    str.append(std::to_string(average_fps()));
-    str.append(", Avg frametime: ");
-    str.append(std::to_string(average_frametime() * 1000.0f));
-    str.append("ms");
-    glfwSetWindowTitle(window, str.c_str());
+    auto& percentiles = _impl->percentiles;
+    snprintf(_impl->title, sizeof(_impl->title), "Fps: %d, Avg frametime: %.3fms, p99: %.3fms, 1%% low: %.1f fps",
+        average_fps(), average_frametime() * 1000.0f, percentiles.p99 * 1000.0f, percentiles.one_percent_low_fps);
+    glfwSetWindowTitle(window, _impl->title);
 }
 
 }
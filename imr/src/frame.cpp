@@ -1,6 +1,7 @@
 #include "swapchain_private.h"
 #include "imr/util.h"
 
+#include <algorithm>
 #include <chrono>
 #include <thread>
 
@@ -14,37 +15,90 @@ void Swapchain::Frame::addCleanupAction(std::function<void(void)>&& fn) {
     _impl->cleanup_queue.push_back(std::move(fn));
 }
 
+void Swapchain::Frame::addWaitSemaphore(VkSemaphore semaphore, uint64_t value, VkPipelineStageFlags stages) {
+    _impl->waits.push_back({ semaphore, value, stages });
+}
+
+void Swapchain::Frame::Impl::append_waits(std::vector<VkSemaphore>& semaphores, std::vector<VkPipelineStageFlags>& stages, std::vector<uint64_t>& values, std::vector<VkCommandBuffer>& command_buffers) {
+    // values for binary semaphores are ignored
+    values.resize(semaphores.size(), 0);
+    for (auto& wait : waits) {
+        semaphores.push_back(wait.semaphore);
+        stages.push_back(wait.stages);
+        values.push_back(wait.value);
+    }
+    waits.clear();
+
+    if (image_acquires.empty())
+        return;
+
+    // Barriers apply in submission order, so a command buffer of its own ahead of the others does the trick
+    auto& vk = device.dispatch;
+    VkCommandBuffer cmdbuf = in_flight.get_command_buffer(in_flight.command_pool);
+    CHECK_VK_THROW(vkBeginCommandBuffer(cmdbuf, tmpPtr((VkCommandBufferBeginInfo) {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    })));
+    vk.cmdPipelineBarrier2KHR(cmdbuf, tmpPtr((VkDependencyInfo) {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .imageMemoryBarrierCount = static_cast<uint32_t>(image_acquires.size()),
+        .pImageMemoryBarriers = image_acquires.data(),
+    }));
+    CHECK_VK_THROW(vkEndCommandBuffer(cmdbuf));
+    command_buffers.insert(command_buffers.begin(), cmdbuf);
+    image_acquires.clear();
+}
+
+VkCommandBuffer Swapchain::Frame::allocateCommandBuffer() {
+    return _impl->in_flight.get_command_buffer(_impl->in_flight.command_pool);
+}
+
 Swapchain::Frame::Frame(Impl&& impl) {
     _impl = std::make_unique<Frame::Impl>(std::move(impl));
 }
 
-Swapchain::Frame::Impl::Impl(Device& device, SwapchainSlot& slot) : device(device), slot(slot) {
-    auto vkb_swapchain = slot.swapchain._impl->swapchain;
-    VkExtent3D size = { vkb_swapchain.extent.width, vkb_swapchain.extent.height, 1 };
-    auto i = make_image_from(device, slot.image, VK_IMAGE_TYPE_2D, size, vkb_swapchain.image_format);
-    image = std::make_unique<Image>(std::move(i));
-}
+Swapchain::Frame::Impl::Impl(Device& device, SwapchainSlot& slot, FrameInFlight& in_flight) : device(device), slot(slot), in_flight(in_flight), image(slot.wrapped_image.get()) {}
 
 Image& Swapchain::Frame::image() const { return *_impl->image; }
 
 Swapchain::Frame::~Frame() {
     //printf("Recycling frame %d in slot %d\n", id, _impl->slot.image_index);
-    // Before we can cleanup the resources we need to wait on the relevant fences
-    // for now let's just wait on ALL of them at once
+    auto& device = _impl->device;
+    // Fences handed to us by the user are outside the device timeline, so we still have to wait on those
     if (!_impl->cleanup_fences.empty()) {
+        Tracer::Span span(device, "wait for cleanup fences");
         for (auto fence : _impl->cleanup_fences) {
             //printf("Waited on fence = %llx\n", fence);
-            CHECK_VK_THROW(vkWaitForFences(_impl->device.device, 1, &fence, true, UINT64_MAX));
+            CHECK_VK_THROW(vkWaitForFences(device.device, 1, &fence, true, UINT64_MAX));
         }
         _impl->cleanup_fences.clear();
     }
 
     // We want to iterate over the queue in a FIFO manner
     std::reverse(_impl->cleanup_queue.begin(), _impl->cleanup_queue.end());
-    for (auto& fn : _impl->cleanup_queue) {
-        fn();
+    if (_impl->submitted) {
+        // The cleanup itself is keyed on the timeline value of our last submission and retired without blocking.
+        // That submission, or one before it, waited on the acquire semaphore, so it's unsignalled again by then.
+        VkSemaphore acquired = swapchain_image_available;
+        device.deferCleanup(_impl->timeline_value, [&device, acquired]() {
+            device.recycleSemaphore(acquired);
+        });
+        for (auto& fn : _impl->cleanup_queue) {
+            device.deferCleanup(_impl->timeline_value, std::move(fn));
+        }
+    } else {
+        // Given up on, e.g. by an exception while recording. Whatever was submitted has no timeline value to wait for, and nothing
+        // might have waited on the acquire semaphore, which then stays signalled. So we wait it all out, and destroy the semaphore.
+        Tracer::Span span(device, "drain abandoned frame");
+        CHECK_VK_THROW(vkWaitForFences(device.device, 1, &_impl->slot.wait_for_previous_present, true, UINT64_MAX));
+        CHECK_VK_THROW(vkDeviceWaitIdle(device.device));
+        vkDestroySemaphore(device.device, swapchain_image_available, nullptr);
+        for (auto& fn : _impl->cleanup_queue) {
+            fn();
+        }
     }
     _impl->cleanup_queue.clear();
+    device.collectGarbage();
 }
 
 void Swapchain::Frame::queuePresent() {
@@ -54,34 +108,47 @@ void Swapchain::Frame::queuePresent() {
     assert(!_impl->submitted && "Cannot submit a frame twice!");
     _impl->submitted = true;
 
-    uint64_t now = imr_get_time_nano();
-    uint64_t delta = now - swapchain._impl->last_present;
-    int64_t delta_us = (int64_t)(delta / 1000);
+    // Uploads staged so far went into this frame or earlier ones, so their space can be reused once everything submitted so far is done
+    device.retireStagedUploads(device._impl->last_timeline_value);
 
-    int64_t min_delta = int64_t(1000000.0 / swapchain.maxFps);
-    //printf("delta: %zu us, min_delta = %zu \n", delta_us, min_delta);
-    int64_t sleep_time = min_delta - delta_us;
-    if (sleep_time > 0) {
-        //printf("we're too fast. throttling by: %zu us\n", sleep_time);
-        std::this_thread::sleep_for(std::chrono::microseconds(sleep_time));
+    bool use_present_wait = swapchain.usePresentWait && device._impl->present_wait_supported;
+    if (use_present_wait && swapchain._impl->present_id > 0) {
+        // Keep the queue of pending presents short: don't queue another frame before the last one was shown.
+        // This gives up early, a timeout or an out of date swapchain isn't our problem here.
+        Tracer::Span span(device, "wait for present");
+        device.dispatch.waitForPresentKHR(swapchain._impl->swapchain.swapchain, swapchain._impl->present_id, 100000000 /* 100ms */);
     }
 
-    swapchain._impl->last_present = now;
+    Tracer::Span pace_span(device, "pace");
+    swapchain._impl->pacer.pace(swapchain.maxFps);
+    pace_span.end();
 
     //printf("Presenting in slot: %d\n", slot.image_index);
 
     std::vector<VkSemaphore> semaphores;
     semaphores.push_back(slot.present_semaphore);
 
+    uint64_t present_id = swapchain._impl->present_id + 1;
+    VkPresentIdKHR present_id_info = {
+        .sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR,
+        .swapchainCount = 1,
+        .pPresentIds = &present_id,
+    };
+
+    Tracer::Span present_span(device, "present");
     VkResult present_result = vkQueuePresentKHR(device.main_queue, tmpPtr((VkPresentInfoKHR) {
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+        .pNext = use_present_wait ? &present_id_info : nullptr,
         .waitSemaphoreCount = static_cast<uint32_t>(semaphores.size()),
         .pWaitSemaphores = semaphores.data(),
         .swapchainCount = 1,
         .pSwapchains = &swapchain._impl->swapchain.swapchain,
         .pImageIndices = &slot.image_index,
     }));
+    present_span.end();
     //printf("Queued presentation, will signal %llx\n", (uint64_t) slot.wait_for_previous_present);
+    if (use_present_wait)
+        swapchain._impl->present_id = present_id;
     switch (present_result) {
         case VK_SUCCESS:
         case VK_SUBOPTIMAL_KHR: break;
@@ -95,10 +162,21 @@ void Swapchain::Frame::queuePresent() {
 
 void Swapchain::beginFrame(std::function<void(Swapchain::Frame&)>&& fn) {
     auto& device = _impl->device;
+    device.collectGarbage();
+
+    if (_impl->frames_in_flight.size() != static_cast<size_t>(std::max(maxFramesInFlight, 1))) {
+        drain();
+        _impl->build_frames_in_flight();
+    }
+    // Waiting for the frame that used these resources last is what bounds how far ahead of the GPU we can get
+    auto& in_flight = *_impl->frames_in_flight[_impl->frame_counter % _impl->frames_in_flight.size()];
+    in_flight.recycle();
+
     while (true) {
         if (_impl->should_resize) {
             _impl->should_resize = false;
-            glfwPollEvents();
+            if (_impl->window)
+                glfwPollEvents();
             drain();
             _impl->destroy_swapchain();
             _impl->build_swapchain();
@@ -109,18 +187,16 @@ void Swapchain::beginFrame(std::function<void(Swapchain::Frame&)>&& fn) {
             continue;
         }
         auto [slot, acquired] = *result;
-        slot.frame.reset();
-        slot.frame = std::make_unique<Frame>(std::move(Frame::Impl(device, slot)));
-        slot.frame->swapchain_image_available = acquired;
-        slot.frame->signal_when_ready = slot.present_semaphore;
-        slot.frame->id = _impl->frame_counter++;
+        in_flight.frame = std::make_unique<Frame>(std::move(Frame::Impl(device, slot, in_flight)));
+        auto& frame = *in_flight.frame;
+        frame.swapchain_image_available = acquired;
+        frame.signal_when_ready = slot.present_semaphore;
+        frame.id = _impl->frame_counter++;
+        // given back by ~Frame
         assert(acquired);
-        slot.frame->addCleanupAction([=, &device]() {
-            vkDestroySemaphore(device.device, acquired, nullptr);
-        });
 
-        //printf("Preparing frame: %d\n", slot.frame->id);
-        fn(*slot.frame);
+        //printf("Preparing frame: %d\n", frame.id);
+        fn(frame);
         break;
     }
 }
@@ -0,0 +1,70 @@
+#include "swapchain_private.h"
+#include "imr/util.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+namespace imr {
+
+/// Sleeps are only trusted up to this much before the deadline, past that we spin
+static const uint64_t spin_margin = 200000; // 0.2ms
+/// Swapchain::maxFps at or above this means there's no cap, that's the default
+static const int uncapped_fps = 999;
+/// Weight of the newest sample in the moving averages
+static const double smoothing = 1.0 / 32.0;
+
+static void wait_until(uint64_t deadline) {
+    while (true) {
+        uint64_t now = imr_get_time_nano();
+        if (now >= deadline)
+            return;
+        uint64_t remaining = deadline - now;
+        if (remaining > spin_margin)
+            std::this_thread::sleep_for(std::chrono::nanoseconds(remaining - spin_margin));
+        else
+            std::this_thread::yield();
+    }
+}
+
+void FramePacer::pace(int max_fps) {
+    uint64_t interval = 1000000000 / std::max(max_fps, 1);
+    // No cap, or one so high we'd spend the whole frame spinning: nothing to wait for, but the stats still get updated
+    bool uncapped = max_fps >= uncapped_fps || interval <= spin_margin;
+    target_interval = uncapped ? 0 : interval;
+
+    uint64_t now = imr_get_time_nano();
+    // If this is the first frame, or we fell behind by more than a frame, we don't try to catch up
+    if (deadline == 0 || uncapped || now > deadline + interval)
+        deadline = now;
+    else
+        wait_until(deadline);
+
+    uint64_t released = imr_get_time_nano();
+    double error = std::abs((double) released - (double) deadline);
+    average_error += (error - average_error) * smoothing;
+    if (last_release != 0) {
+        double delta = released - last_release;
+        double deviation = delta - average_interval;
+        average_interval += deviation * smoothing;
+        interval_variance += (deviation * deviation - interval_variance) * smoothing;
+    }
+    last_release = released;
+    deadline += interval;
+}
+
+Swapchain::PacingStats FramePacer::stats() const {
+    return (Swapchain::PacingStats) {
+        .target_frametime = (float) (target_interval / 1000000000.0),
+        .average_frametime = (float) (average_interval / 1000000000.0),
+        .frametime_deviation = (float) (std::sqrt(interval_variance) / 1000000000.0),
+        .average_error = (float) (average_error / 1000000000.0),
+    };
+}
+
+Swapchain::PacingStats Swapchain::pacingStats() const {
+    return _impl->pacer.stats();
+}
+
+}
@@ -0,0 +1,213 @@
+#include "swapchain_private.h"
+
+#include <array>
+#include <unordered_map>
+
+namespace imr {
+
+struct GpuProfiler::Impl {
+    Swapchain& swapchain;
+    Device& device;
+    /// Two queries per scope
+    uint32_t capacity;
+
+    bool timestamps = false;
+    /// Nanoseconds per tick
+    float period;
+    uint64_t valid_mask;
+
+    /// The queries of one frame, recycled once it has retired and they were read
+    struct FrameQueries {
+        VkQueryPool pool;
+        uint32_t used = 0;
+        /// Which scope each pair of queries belongs to
+        std::vector<size_t> scopes;
+    };
+    std::vector<std::unique_ptr<FrameQueries>> queries;
+    std::vector<FrameQueries*> free_queries;
+    FrameQueries* current = nullptr;
+    std::optional<size_t> current_frame;
+    /// Frames whose queries weren't read yet
+    size_t pending = 0;
+
+    struct ScopeHistory {
+        std::string name;
+        /// The name interned by the Tracer with that id, so it isn't copied for every event
+        uint64_t traced_by = 0;
+        const char* traced_name = nullptr;
+        /// A ring of the last `window` samples
+        std::array<float, window> samples;
+        size_t count = 0;
+        size_t next = 0;
+    };
+    std::vector<ScopeHistory> history;
+    std::unordered_map<std::string, size_t> by_name;
+
+    Impl(Swapchain&, uint32_t max_scopes_per_frame);
+    ~Impl();
+
+    FrameQueries* frame_queries();
+    void collect(FrameQueries*);
+};
+
+GpuProfiler::Impl::Impl(Swapchain& swapchain, uint32_t max_scopes_per_frame) : swapchain(swapchain), device(swapchain._impl->device), capacity(max_scopes_per_frame * 2) {
+    // Scopes can be on either queue, so both have to support timestamps, and the ticks wrap around at the narrowest of them
+    auto families = device.physical_device.get_queue_families();
+    uint32_t valid_bits = std::min(families[device.main_queue_idx].timestampValidBits, families[device.compute_queue_idx].timestampValidBits);
+    timestamps = device._impl->host_query_reset_supported && valid_bits > 0;
+    period = device.physical_device.properties.limits.timestampPeriod;
+    valid_mask = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+}
+
+GpuProfiler::Impl::~Impl() {
+    assert(pending == 0 && "the frames the profiler was used in must have retired, see Swapchain::drain()");
+    for (auto& frame_queries : queries)
+        vkDestroyQueryPool(device.device, frame_queries->pool, nullptr);
+}
+
+GpuProfiler::Impl::FrameQueries* GpuProfiler::Impl::frame_queries() {
+    auto& frames_in_flight = swapchain._impl->frames_in_flight;
+    auto& frame = frames_in_flight[(swapchain._impl->frame_counter - 1) % frames_in_flight.size()]->frame;
+    assert(frame && !frame->_impl->submitted && "scopes only go in the command buffers of the frame being recorded");
+    if (current_frame == frame->id)
+        return current;
+
+    if (free_queries.empty()) {
+        auto& frame_queries = queries.emplace_back(std::make_unique<FrameQueries>());
+        CHECK_VK_THROW(vkCreateQueryPool(device.device, tmpPtr((VkQueryPoolCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = capacity,
+        }), nullptr, &frame_queries->pool));
+        vkResetQueryPool(device.device, frame_queries->pool, 0, capacity);
+        free_queries.push_back(frame_queries.get());
+    }
+    current = free_queries.back();
+    free_queries.pop_back();
+    current_frame = frame->id;
+    pending++;
+
+    // The cleanup runs once the frame has retired, so the results are there and reading them doesn't wait
+    frame->addCleanupAction([this, frame_queries = current]() {
+        collect(frame_queries);
+    });
+    return current;
+}
+
+void GpuProfiler::Impl::collect(FrameQueries* frame_queries) {
+    pending--;
+    if (frame_queries == current)
+        current_frame.reset();
+
+    std::vector<uint64_t> results(frame_queries->used);
+    // Not ready if the frame never got submitted, the results are just dropped then
+    VkResult result = frame_queries->used == 0 ? VK_NOT_READY : vkGetQueryPoolResults(device.device, frame_queries->pool, 0, frame_queries->used, results.size() * sizeof(uint64_t), results.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (result == VK_SUCCESS) {
+        // scopes with the same name add up
+        std::unordered_map<size_t, double> totals;
+        for (size_t i = 0; i < frame_queries->scopes.size(); i++) {
+            uint64_t ticks = (results[i * 2 + 1] - results[i * 2]) & valid_mask;
+            totals[frame_queries->scopes[i]] += ticks * (double) period / 1000000.0;
+        }
+        // The Tracer shows each scope on its own
+        auto tracer = device._impl->tracer.load();
+        if (auto offset = tracer ? tracer->gpu_clock_offset(period) : std::nullopt) {
+            std::unique_lock lock(tracer->mutex);
+            for (size_t i = 0; i < frame_queries->scopes.size(); i++) {
+                uint64_t begin = static_cast<uint64_t>(results[i * 2] * (double) period + *offset);
+                uint64_t duration = static_cast<uint64_t>(((results[i * 2 + 1] - results[i * 2]) & valid_mask) * (double) period);
+                auto& scope_history = history[frame_queries->scopes[i]];
+                if (scope_history.traced_by != tracer->id) {
+                    scope_history.traced_by = tracer->id;
+                    scope_history.traced_name = tracer->intern(scope_history.name);
+                }
+                tracer->gpu_events.push({ scope_history.traced_name, begin, begin + duration }, tracer->max_events);
+            }
+        }
+        for (auto [scope, total] : totals) {
+            auto& scope_history = history[scope];
+            scope_history.samples[scope_history.next] = static_cast<float>(total);
+            scope_history.next = (scope_history.next + 1) % window;
+            scope_history.count = std::min(scope_history.count + 1, window);
+        }
+    }
+
+    vkResetQueryPool(device.device, frame_queries->pool, 0, capacity);
+    frame_queries->used = 0;
+    frame_queries->scopes.clear();
+    free_queries.push_back(frame_queries);
+}
+
+GpuProfiler::GpuProfiler(Swapchain& swapchain, uint32_t max_scopes_per_frame) {
+    _impl = std::make_unique<Impl>(swapchain, max_scopes_per_frame);
+}
+
+GpuProfiler::~GpuProfiler() = default;
+
+bool GpuProfiler::timestamps_supported() const {
+    return _impl->timestamps;
+}
+
+GpuProfiler::Scope GpuProfiler::scope(VkCommandBuffer cmdbuf, const char* name) {
+    auto& device = _impl->device;
+    if (device.dispatch.fp_vkCmdBeginDebugUtilsLabelEXT) {
+        device.dispatch.cmdBeginDebugUtilsLabelEXT(cmdbuf, tmpPtr((VkDebugUtilsLabelEXT) {
+            .sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT,
+            .pLabelName = name,
+        }));
+    }
+
+    if (!_impl->timestamps)
+        return { *this, cmdbuf, VK_NULL_HANDLE, 0 };
+    auto frame_queries = _impl->frame_queries();
+    if (frame_queries->used + 2 > _impl->capacity)
+        return { *this, cmdbuf, VK_NULL_HANDLE, 0 };
+
+    auto [found, inserted] = _impl->by_name.try_emplace(name, _impl->history.size());
+    if (inserted)
+        _impl->history.push_back({ .name = name });
+    frame_queries->scopes.push_back(found->second);
+
+    uint32_t begin_query = frame_queries->used;
+    frame_queries->used += 2;
+    device.dispatch.cmdWriteTimestamp2KHR(cmdbuf, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, frame_queries->pool, begin_query);
+    return { *this, cmdbuf, frame_queries->pool, begin_query + 1 };
+}
+
+GpuProfiler::Scope::Scope(GpuProfiler& profiler, VkCommandBuffer cmdbuf, VkQueryPool pool, uint32_t end_query) : profiler(profiler), cmdbuf(cmdbuf), pool(pool), end_query(end_query) {}
+
+GpuProfiler::Scope::~Scope() {
+    auto& device = profiler._impl->device;
+    if (pool)
+        device.dispatch.cmdWriteTimestamp2KHR(cmdbuf, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, pool, end_query);
+    if (device.dispatch.fp_vkCmdEndDebugUtilsLabelEXT)
+        device.dispatch.cmdEndDebugUtilsLabelEXT(cmdbuf);
+}
+
+std::vector<GpuProfiler::Stats> GpuProfiler::stats() const {
+    std::vector<Stats> stats;
+    for (auto& scope_history : _impl->history) {
+        if (scope_history.count == 0)
+            continue;
+        // the newest sample is right before next
+        Stats scope_stats = {
+            .name = scope_history.name,
+            .samples = scope_history.count,
+            .last = scope_history.samples[(scope_history.next + window - 1) % window],
+            .average = 0,
+            .min = scope_history.samples[0],
+            .max = scope_history.samples[0],
+        };
+        for (size_t i = 0; i < scope_history.count; i++) {
+            float sample = scope_history.samples[i];
+            scope_stats.average += sample;
+            scope_stats.min = std::min(scope_stats.min, sample);
+            scope_stats.max = std::max(scope_stats.max, sample);
+        }
+        scope_stats.average /= scope_history.count;
+        stats.push_back(std::move(scope_stats));
+    }
+    return stats;
+}
+
+}
@@ -9,12 +9,14 @@ T* optional_to_ptr(std::optional<T>& o) {
     return nullptr;
 }
 
-GraphicsPipeline::GraphicsPipeline(imr::Device& d, std::vector<ShaderEntryPoint*>&& stages, RenderTargetsState rts, imr::GraphicsPipeline::StateBuilder state) {
-    _impl = std::make_unique<Impl>(d, std::move(stages), rts, state);
+GraphicsPipeline::GraphicsPipeline(imr::Device& d, std::vector<ShaderEntryPoint*>&& stages, RenderTargetsState rts, imr::GraphicsPipeline::StateBuilder state, PipelineOptions options) {
+    _impl = std::make_unique<Impl>(d, std::move(stages), rts, state, options);
 }
 
-GraphicsPipeline::Impl::Impl(Device& device, std::vector<ShaderEntryPoint*>&& stages, RenderTargetsState render_targets, StateBuilder state) : device_(device) {
+GraphicsPipeline::Impl::Impl(Device& device, std::vector<ShaderEntryPoint*>&& stages, RenderTargetsState render_targets, StateBuilder state, const PipelineOptions& options) : device_(device) {
     std::vector<VkPipelineShaderStageCreateInfo> vk_stages;
+    // the stages point into these, so they can't move around
+    std::deque<PackedSpecialization> specializations;
     VkShaderStageFlags conflicts = 0;
     std::optional<ReflectedLayout> merged_layout;
     for (auto stage : stages) {
@@ -25,6 +27,7 @@ GraphicsPipeline::Impl::Impl(Device& device, std::vector<ShaderEntryPoint*>&& st
             .stage = stage->stage(),
             .module = stage->module().vk_shader_module(),
             .pName = stage->name().c_str(),
+            .pSpecializationInfo = specializations.emplace_back(stage->module(), stage->specialization()).get(),
         };
         vk_stages.push_back(vk_stage);
         if (!merged_layout)
@@ -33,7 +36,7 @@ GraphicsPipeline::Impl::Impl(Device& device, std::vector<ShaderEntryPoint*>&& st
             merged_layout = ReflectedLayout(*merged_layout, *stage->_impl->reflected);
     }
 
-    layout = std::make_unique<PipelineLayout>(device, *merged_layout);
+    layout = std::make_unique<PipelineLayout>(device, *merged_layout, VK_PIPELINE_BIND_POINT_GRAPHICS, options);
     final_layout = *merged_layout;
 
     std::vector<VkDynamicState> dynamic_states = {
@@ -76,7 +79,7 @@ GraphicsPipeline::Impl::Impl(Device& device, std::vector<ShaderEntryPoint*>&& st
     VkGraphicsPipelineCreateInfo pipeline_create_info = {
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
 
-        .flags = 0,
+        .flags = layout->descriptor_buffer ? VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT : 0u,
         .stageCount = static_cast<uint32_t>(vk_stages.size()),
         .pStages = vk_stages.data(),
         .pVertexInputState = optional_to_ptr(state.vertexInputState),
@@ -94,7 +97,8 @@ GraphicsPipeline::Impl::Impl(Device& device, std::vector<ShaderEntryPoint*>&& st
 
     appendPNext((VkBaseOutStructure*) &pipeline_create_info, (VkBaseOutStructure*) &rendertargets_state);
 
-    CHECK_VK_THROW(vkCreateGraphicsPipelines(device_.device, VK_NULL_HANDLE, 1, &pipeline_create_info, VK_NULL_HANDLE, &pipeline));
+    Tracer::Span span(device_, "create graphics pipeline");
+    CHECK_VK_THROW(vkCreateGraphicsPipelines(device_.device, device_.pipeline_cache, 1, &pipeline_create_info, VK_NULL_HANDLE, &pipeline));
 }
 
 GraphicsPipeline::Impl::~Impl() {
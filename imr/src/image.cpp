@@ -1,5 +1,7 @@
 #include "imr_private.h"
 
+#include <map>
+
 namespace imr {
 
 struct Image::Impl {
@@ -8,12 +10,20 @@ struct Image::Impl {
     VkImageType type;
     VkExtent3D size;
     VkFormat format;
+    VkImageUsageFlags usage;
     std::optional<VmaAllocation> vma_allocation;
+    /// Slot in the device's BindlessHeap, once we asked for one
+    std::optional<uint32_t> bindless_index;
+    ResourceState state;
+
+    using ViewKey = std::tuple<VkImageViewType, VkFormat, VkImageAspectFlags, uint32_t, uint32_t, uint32_t, uint32_t>;
+    /// Created by Image::view() on first use, destroyed along with the image
+    std::map<ViewKey, VkImageView> views;
 
-    Impl(Device& device, VkImageType type, VkExtent3D size, VkFormat format)
-    : device(device), handle(VK_NULL_HANDLE), type(type), size(size), format(format) {}
-    Impl(Device& device, VkImage existing_handle, VkImageType type, VkExtent3D size, VkFormat format)
-    : device(device), handle(existing_handle), type(type), size(size), format(format) {}
+    Impl(Device& device, VkImageType type, VkExtent3D size, VkFormat format, VkImageUsageFlags usage)
+    : device(device), handle(VK_NULL_HANDLE), type(type), size(size), format(format), usage(usage) {}
+    Impl(Device& device, VkImage existing_handle, VkImageType type, VkExtent3D size, VkFormat format, VkImageUsageFlags usage)
+    : device(device), handle(existing_handle), type(type), size(size), format(format), usage(usage) {}
 };
 
 VkImage Image::handle() const { return _impl->handle; }
@@ -22,7 +32,7 @@ VkExtent3D Image::size() const { return _impl->size; }
 VkFormat Image::format() const { return _impl->format; }
 
 Image::Image(Device& device, VkImageType dim, VkExtent3D size, VkFormat format, VkImageUsageFlagBits usage) {
-    _impl = std::make_unique<Impl>(device, dim, size, format);
+    _impl = std::make_unique<Impl>(device, dim, size, format, usage);
     VkImageCreateInfo image_create_info = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
         .imageType = dim,
@@ -44,8 +54,8 @@ Image::Image(Device& device, VkImageType dim, VkExtent3D size, VkFormat format,
     vmaCreateImage(device._impl->allocator, &image_create_info, &alloc_info, &_impl->handle, &vma_allocation, nullptr);
 }
 
-Image make_image_from(Device& device, VkImage existing_handle, VkImageType dim, VkExtent3D size, VkFormat format) {
-    return Image(Image::Impl(device, existing_handle, dim, size, format));
+Image make_image_from(Device& device, VkImage existing_handle, VkImageType dim, VkExtent3D size, VkFormat format, VkImageUsageFlags usage) {
+    return Image(Image::Impl(device, existing_handle, dim, size, format, usage));
 }
 
 Image::Image(Impl&& impl) {
@@ -315,6 +325,15 @@ static VkImageAspectFlagBits aspects_from_format(VkFormat format) {
     throw std::runtime_error("TODO: unhandled format");
 }
 
+VkImageViewType image_type_to_view_type(VkImageType type) {
+    switch (type) {
+        case VK_IMAGE_TYPE_1D: return VK_IMAGE_VIEW_TYPE_1D;
+        case VK_IMAGE_TYPE_2D: return VK_IMAGE_VIEW_TYPE_2D;
+        case VK_IMAGE_TYPE_3D: return VK_IMAGE_VIEW_TYPE_3D;
+        default: throw std::runtime_error("Unknown image type");
+    }
+}
+
 VkImageSubresourceRange Image::whole_image_subresource_range() const {
     VkImageSubresourceRange range = {
         .aspectMask = aspects_from_format(format()),
@@ -326,10 +345,42 @@ VkImageSubresourceRange Image::whole_image_subresource_range() const {
     return range;
 }
 
+VkImageView Image::view(std::optional<VkImageViewType> view_type, std::optional<VkImageSubresourceRange> subresource, std::optional<VkFormat> view_format) {
+    VkImageViewType final_view_type = view_type ? *view_type : image_type_to_view_type(type());
+    VkImageSubresourceRange range = subresource ? *subresource : whole_image_subresource_range();
+    VkFormat final_format = view_format ? *view_format : format();
+
+    Impl::ViewKey key = { final_view_type, final_format, range.aspectMask, range.baseMipLevel, range.levelCount, range.baseArrayLayer, range.layerCount };
+    auto& view = _impl->views[key];
+    if (!view) {
+        CHECK_VK_THROW(vkCreateImageView(_impl->device.device, tmpPtr((VkImageViewCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = handle(),
+            .viewType = final_view_type,
+            .format = final_format,
+            .subresourceRange = range,
+        }), nullptr, &view));
+    }
+    return view;
+}
+
+ResourceState& Image::state() { return _impl->state; }
+
+uint32_t Image::bindless_index() {
+    if (!_impl->bindless_index)
+        _impl->bindless_index = _impl->device.bindless()._impl->add_image(view(), _impl->usage);
+    return *_impl->bindless_index;
+}
+
 Image::~Image() {
-    if (_impl)
-        if (_impl->vma_allocation)
-            vmaDestroyImage(_impl->device._impl->allocator, _impl->handle, _impl->vma_allocation.value());
+    if (!_impl)
+        return;
+    if (_impl->bindless_index)
+        _impl->device._impl->bindless->_impl->remove_image(*_impl->bindless_index);
+    for (auto& [key, view] : _impl->views)
+        vkDestroyImageView(_impl->device.device, view, nullptr);
+    if (_impl->vma_allocation)
+        vmaDestroyImage(_impl->device._impl->allocator, _impl->handle, _impl->vma_allocation.value());
 }
 
 }
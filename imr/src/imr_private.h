@@ -5,17 +5,289 @@
 
 #include "vk_mem_alloc.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
 #define CHECK_VK_THROW(do) CHECK_VK(do, throw std::runtime_error(#do))
 
 namespace imr {
 
+/// Persistently mapped upload buffer, shared by all uploads on a Device.
+/// Space is handed out linearly and given back in the same order, once the submission the upload went into has retired.
+struct StagingRing {
+    Device& device;
+    StagingRing(Device&, size_t capacity);
+    StagingRing(StagingRing&) = delete;
+    ~StagingRing();
+
+    std::unique_ptr<Buffer> buffer;
+    std::byte* mapped;
+    size_t capacity;
+
+    /// Absolute byte counts, positions in the buffer are taken modulo the capacity
+    uint64_t head = 0;
+    uint64_t tail = 0;
+
+    struct Staged {
+        /// The head right after it, the tail moves there once it's given back
+        uint64_t end;
+        /// A one-off staging buffer, for uploads that didn't fit in the ring
+        std::unique_ptr<Buffer> overflow;
+        /// Once Device::timeline reaches this the GPU is done with it, unset until it's retired
+        std::optional<uint64_t> timeline_value;
+    };
+    /// Everything staged and not given back yet, oldest first
+    std::deque<Staged> staged;
+    /// How many were given back so far
+    uint64_t released = 0;
+
+    /// Carves out space in the ring, if there is enough of it
+    std::optional<size_t> allocate(size_t size);
+    /// Copies the data to a staging location and returns it, falling back to a one-off buffer when the ring is full
+    std::tuple<VkBuffer, size_t> stage(size_t size, const void* data);
+
+    /// How many uploads were staged so far
+    using Mark = uint64_t;
+    Mark mark() const;
+    /// What was staged between the marks can be reused once Device::timeline reaches timeline_value.
+    /// Uploads that were retired already keep their value, so retire(0, mark(), value) covers all the others.
+    void retire(Mark begin, Mark end, uint64_t timeline_value);
+    /// Gives back everything staged before the mark right away, the GPU must be done with it
+    void release(Mark);
+    /// Gives back what the GPU is done with, in the order it was staged. Happens in stage(), so new uploads get the space as soon as possible.
+    void reclaim();
+};
+
+/// Hands out descriptor sets from a few big pools, which are created as needed and kept until the Device goes away, or until they are outgrown by pool_sizes.
+/// A pool is reset as a whole once every set allocated from it has been given back, which the bind helpers do when they are destroyed,
+/// typically from the cleanup of the frame that used them. Not thread-safe.
+struct DescriptorAllocator {
+    Device& device;
+    DescriptorAllocator(Device&);
+    DescriptorAllocator(DescriptorAllocator&) = delete;
+    ~DescriptorAllocator();
+
+    /// How many descriptors of each type new pools get. Starts with the common types, and grows when a layout needs others or more.
+    std::map<VkDescriptorType, uint32_t> pool_sizes;
+    /// Bumped whenever pool_sizes grows, older pools are destroyed rather than reused once they're empty
+    uint32_t sizes_generation = 0;
+
+    struct Pool {
+        VkDescriptorPool pool;
+        size_t live_sets = 0;
+        uint32_t sizes_generation;
+    };
+    std::vector<std::unique_ptr<Pool>> pools;
+    std::vector<Pool*> free_pools;
+    /// Where new sets come from, it's only recycled once it's full
+    Pool* current = nullptr;
+
+    struct Allocation {
+        VkDescriptorSet set = VK_NULL_HANDLE;
+        Pool* pool = nullptr;
+    };
+    /// sizes are what one set of that layout holds, see PipelineLayout::set_pool_sizes
+    Allocation allocate(VkDescriptorSetLayout, const std::vector<VkDescriptorPoolSize>& sizes);
+    /// The set must not be in use by the GPU anymore
+    void release(Allocation);
+
+    Pool* next_pool();
+    void recycle(Pool*);
+    void destroy(Pool*);
+};
+
+/// The VK_EXT_descriptor_buffer counterpart to DescriptorAllocator: hands out ranges of big, mapped descriptor buffers.
+/// Ranges are bumped off the current block, which is reused once it's full and every range from it has been given back.
+struct DescriptorBufferAllocator {
+    Device& device;
+    DescriptorBufferAllocator(Device&);
+    DescriptorBufferAllocator(DescriptorBufferAllocator&) = delete;
+    ~DescriptorBufferAllocator();
+
+    struct Block {
+        std::unique_ptr<Buffer> buffer;
+        VkDeviceAddress address;
+        VkDeviceSize used = 0;
+        size_t live_ranges = 0;
+    };
+    std::vector<std::unique_ptr<Block>> blocks;
+    std::vector<Block*> free_blocks;
+    Block* current = nullptr;
+
+    struct Allocation {
+        Block* block = nullptr;
+        VkDeviceSize offset = 0;
+    };
+    Allocation allocate(VkDeviceSize size);
+    /// The descriptors must not be in use by the GPU anymore
+    void release(Allocation);
+
+    Block* next_block();
+};
+
+struct BindlessHeap::Impl {
+    Device& device;
+    Impl(Device&);
+    Impl(Impl&) = delete;
+    ~Impl();
+
+    VkDescriptorSetLayout layout;
+    VkDescriptorPool pool;
+    VkDescriptorSet set;
+
+    uint32_t image_capacity;
+    uint32_t sampler_capacity;
+    /// Slots that were never used are handed out from next_*, and given back ones from free_*
+    std::vector<uint32_t> free_images;
+    uint32_t next_image = 0;
+    std::vector<uint32_t> free_samplers;
+    uint32_t next_sampler = 0;
+
+    uint32_t allocate_slot(std::vector<uint32_t>& free, uint32_t& next, uint32_t capacity);
+    /// Only reuses the slot once the frames in flight are done with it
+    void release_slot(std::vector<uint32_t>& free, uint32_t slot);
+
+    uint32_t add_image(VkImageView, VkImageUsageFlags);
+    void remove_image(uint32_t slot);
+};
+
+/// Worker threads for Device::compileAsync
+struct CompileThreads {
+    CompileThreads();
+    CompileThreads(CompileThreads&) = delete;
+    ~CompileThreads();
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::function<void(void)>> jobs;
+    bool stopping = false;
+    std::vector<std::thread> threads;
+
+    void enqueue(std::function<void(void)>&& job);
+    void work();
+};
+
+struct Tracer::Impl {
+    Device& device;
+    Impl(Device&, size_t max_events);
+    Impl(Impl&) = delete;
+
+    /// Tells tracers apart, even if one is created where another was
+    uint64_t id;
+    uint64_t start;
+    size_t max_events;
+
+    struct Event {
+        const char* name;
+        uint64_t begin;
+        uint64_t end;
+    };
+    /// The last max_events events, oldest first starting at next once it's full
+    struct EventRing {
+        std::vector<Event> events;
+        size_t next = 0;
+        /// Overwritten to make room
+        uint64_t dropped = 0;
+
+        void push(const Event& event, size_t max_events);
+        template<typename F>
+        void for_each(F f) const {
+            for (size_t i = 0; i < events.size(); i++)
+                f(events[(next + i) % events.size()]);
+        }
+    };
+    /// Only its own thread records into it, the mutex is for writeJson()
+    struct ThreadBuffer {
+        std::thread::id thread;
+        uint32_t tid;
+        std::mutex mutex;
+        EventRing events;
+    };
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> threads;
+    ThreadBuffer& thread_buffer();
+    void record(const char* name, uint64_t begin, uint64_t end);
+
+    /// GpuProfiler scopes, already on the CPU clock. Guarded by mutex.
+    EventRing gpu_events;
+    /// Names that don't outlive themselves like string literals do, e.g. those of GpuProfiler scopes. Guarded by mutex.
+    std::unordered_set<std::string> names;
+    const char* intern(const std::string& name);
+    /// Whether GPU timestamps can be put on the CPU clock
+    bool calibrated = false;
+    /// What to add to a GPU timestamp, converted to nanoseconds, to get imr_get_time_nano() time
+    std::optional<int64_t> gpu_clock_offset(float timestamp_period);
+};
+
 struct Device::Impl {
     VmaAllocator allocator;
 
+    /// VK_KHR_present_id and VK_KHR_present_wait are both enabled
+    bool present_wait_supported = false;
+    /// hostQueryReset is enabled
+    bool host_query_reset_supported = false;
+    /// VK_EXT_calibrated_timestamps is enabled
+    bool calibrated_timestamps_supported = false;
+    /// Set while a Tracer is recording
+    std::atomic<Tracer::Impl*> tracer = nullptr;
+    /// How many descriptors a pushed set can hold, 0 if VK_KHR_push_descriptor isn't available
+    uint32_t max_push_descriptors = 0;
+
     //std::vector<std::unique_ptr<Buffer>> buffers;
     std::vector<std::unique_ptr<Image>> images;
+
+    std::vector<VkFence> free_fences;
+    std::vector<VkSemaphore> free_semaphores;
+    void destroy_sync_pools(Device&);
+
+    uint64_t last_timeline_value = 0;
+    std::deque<std::tuple<uint64_t, std::function<void(void)>>> deferred_cleanup;
+
+    /// Signalled by submissions to the compute queue
+    VkSemaphore compute_timeline;
+    uint64_t last_compute_value = 0;
+
+    /// Empty if the pipeline cache isn't persisted
+    std::string pipeline_cache_path;
+    void load_pipeline_cache(Device&);
+    void save_pipeline_cache(Device&);
+
+    /// Started on first use
+    std::unique_ptr<CompileThreads> compile_threads;
+    /// What pipelines go by instead of reading Device::use_descriptor_buffers, on a compile thread that's what it was when the job was queued
+    bool use_descriptor_buffers(Device&);
+
+    /// Created by Device::bindless()
+    std::unique_ptr<BindlessHeap> bindless;
+
+    /// Created on first use
+    std::unique_ptr<DescriptorAllocator> descriptors;
+    DescriptorAllocator& descriptor_allocator(Device&);
+
+    /// Only meaningful when Device::descriptor_buffer_supported
+    VkPhysicalDeviceDescriptorBufferPropertiesEXT descriptor_buffer_properties;
+    /// Created on first use
+    std::unique_ptr<DescriptorBufferAllocator> descriptor_buffers;
+    DescriptorBufferAllocator& descriptor_buffer_allocator(Device&);
+
+    /// Created on first use
+    std::unique_ptr<StagingRing> staging;
+    StagingRing& staging_ring(Device&);
 };
 
+/// The accesses that write, for telling hazards apart
+static const VkAccessFlags2 write_access_flags = VK_ACCESS_2_SHADER_WRITE_BIT
+    | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT
+    | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT
+    | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+    | VK_ACCESS_2_TRANSFER_WRITE_BIT
+    | VK_ACCESS_2_HOST_WRITE_BIT
+    | VK_ACCESS_2_MEMORY_WRITE_BIT;
+
 static inline void appendPNext(VkBaseOutStructure* base, VkBaseOutStructure* ext) {
     while (base->pNext) {
         base = base->pNext;
@@ -23,7 +295,8 @@ static inline void appendPNext(VkBaseOutStructure* base, VkBaseOutStructure* ext
     base->pNext = ext;
 }
 
-Image make_image_from(Device& device, VkImage existing_handle, VkImageType dim, VkExtent3D size, VkFormat format);
+Image make_image_from(Device& device, VkImage existing_handle, VkImageType dim, VkExtent3D size, VkFormat format, VkImageUsageFlags usage);
+VkImageViewType image_type_to_view_type(VkImageType type);
 
 }
 
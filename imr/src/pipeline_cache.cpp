@@ -0,0 +1,126 @@
+#include "imr_private.h"
+#include "imr/util.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+namespace imr {
+
+/// Goes in front of the driver's data, so we notice when a cache file comes from another device or driver
+struct PipelineCacheFileHeader {
+    uint32_t magic;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint32_t driver_version;
+    uint8_t uuid[VK_UUID_SIZE];
+    uint64_t data_size;
+};
+
+static const uint32_t pipeline_cache_magic = 0x43524d49; // "IMRC"
+
+/// Next to the executable unless $IMR_PIPELINE_CACHE says otherwise, an empty value disables the file altogether
+static std::string default_pipeline_cache_path() {
+    if (auto env = getenv("IMR_PIPELINE_CACHE"))
+        return env;
+    const char* loc = imr_get_executable_location();
+    auto path = std::filesystem::path(loc).parent_path() / "imr_pipeline_cache.bin";
+    free((char*) loc);
+    return path.string();
+}
+
+static bool is_cache_valid(const VkPhysicalDeviceProperties& properties, const unsigned char* data, size_t size) {
+    if (size < sizeof(PipelineCacheFileHeader))
+        return false;
+    PipelineCacheFileHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != pipeline_cache_magic
+        || header.vendor_id != properties.vendorID
+        || header.device_id != properties.deviceID
+        || header.driver_version != properties.driverVersion
+        || memcmp(header.uuid, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0
+        || header.data_size != size - sizeof(header))
+        return false;
+
+    // The driver checks its own header too, but some are less careful than others
+    VkPipelineCacheHeaderVersionOne vk_header;
+    if (header.data_size < sizeof(vk_header))
+        return false;
+    memcpy(&vk_header, data + sizeof(header), sizeof(vk_header));
+    return vk_header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+        && vk_header.vendorID == properties.vendorID
+        && vk_header.deviceID == properties.deviceID
+        && memcmp(vk_header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void Device::Impl::load_pipeline_cache(Device& device) {
+    pipeline_cache_path = default_pipeline_cache_path();
+    auto& properties = device.physical_device.properties;
+
+    size_t size = 0;
+    unsigned char* data = nullptr;
+    const void* initial_data = nullptr;
+    size_t initial_size = 0;
+    if (!pipeline_cache_path.empty() && imr_read_file(pipeline_cache_path.c_str(), &size, &data)) {
+        if (is_cache_valid(properties, data, size)) {
+            initial_data = data + sizeof(PipelineCacheFileHeader);
+            initial_size = size - sizeof(PipelineCacheFileHeader);
+        } else {
+            fprintf(stderr, "Ignoring pipeline cache %s, it's from another device or driver\n", pipeline_cache_path.c_str());
+        }
+    }
+
+    VkResult result = vkCreatePipelineCache(device.device, tmpPtr((VkPipelineCacheCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = initial_size,
+        .pInitialData = initial_data,
+    }), nullptr, &device.pipeline_cache);
+    // don't let a bad file stop us, start over with an empty cache
+    if (result != VK_SUCCESS && initial_data) {
+        CHECK_VK_THROW(vkCreatePipelineCache(device.device, tmpPtr((VkPipelineCacheCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        }), nullptr, &device.pipeline_cache));
+    } else {
+        CHECK_VK_THROW(result);
+    }
+    free(data);
+}
+
+void Device::Impl::save_pipeline_cache(Device& device) {
+    if (pipeline_cache_path.empty())
+        return;
+    auto& properties = device.physical_device.properties;
+
+    size_t size;
+    CHECK_VK(vkGetPipelineCacheData(device.device, device.pipeline_cache, &size, nullptr), return);
+    std::vector<unsigned char> contents(sizeof(PipelineCacheFileHeader) + size);
+    CHECK_VK(vkGetPipelineCacheData(device.device, device.pipeline_cache, &size, contents.data() + sizeof(PipelineCacheFileHeader)), return);
+    contents.resize(sizeof(PipelineCacheFileHeader) + size);
+
+    PipelineCacheFileHeader header = {
+        .magic = pipeline_cache_magic,
+        .vendor_id = properties.vendorID,
+        .device_id = properties.deviceID,
+        .driver_version = properties.driverVersion,
+        .data_size = size,
+    };
+    memcpy(header.uuid, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    memcpy(contents.data(), &header, sizeof(header));
+
+    // Write to the side and move it in place, so a crash or a concurrent run never leaves a half-written cache behind
+    auto tmp_path = pipeline_cache_path + ".tmp";
+    std::error_code error;
+    if (imr_write_file(tmp_path.c_str(), contents.size(), reinterpret_cast<const char*>(contents.data()))) {
+        std::filesystem::rename(tmp_path, pipeline_cache_path, error);
+    } else {
+        error = std::make_error_code(std::errc::io_error);
+    }
+    if (error) {
+        fprintf(stderr, "Failed to save the pipeline cache to %s: %s\n", pipeline_cache_path.c_str(), error.message().c_str());
+        std::filesystem::remove(tmp_path, error);
+    }
+}
+
+}
@@ -15,13 +15,7 @@ void Swapchain::Frame::presentFromBuffer(VkBuffer buffer, VkFence signal_when_re
     if (sem)
         semaphores.push_back(*sem);
 
-    VkCommandBuffer cmdbuf;
-    CHECK_VK_THROW(vkAllocateCommandBuffers(device.device, tmpPtr((VkCommandBufferAllocateInfo) {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = device.pool,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = 1,
-    }), &cmdbuf));
+    VkCommandBuffer cmdbuf = allocateCommandBuffer();
 
     CHECK_VK_THROW(vkBeginCommandBuffer(cmdbuf, tmpPtr((VkCommandBufferBeginInfo) {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
@@ -84,22 +78,35 @@ void Swapchain::Frame::presentFromBuffer(VkBuffer buffer, VkFence signal_when_re
     std::vector<VkPipelineStageFlags> stage_flags;
     for (auto& sem : semaphores)
         stage_flags.emplace_back(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+    std::vector<uint64_t> wait_values;
+    std::vector<VkCommandBuffer> command_buffers = { cmdbuf };
+    _impl->append_waits(semaphores, stage_flags, wait_values, command_buffers);
+
+    uint64_t timeline_value = device.nextTimelineValue();
+    VkSemaphore signal_semaphores[] = { slot.present_semaphore, device.timeline };
+    uint64_t signal_values[] = { 0, timeline_value };
 
     vkEndCommandBuffer(cmdbuf);
+    Tracer::Span submit_span(device, "submit");
     vkQueueSubmit(device.main_queue, 1, tmpPtr((VkSubmitInfo) {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = tmpPtr((VkTimelineSemaphoreSubmitInfo) {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .waitSemaphoreValueCount = static_cast<uint32_t>(wait_values.size()),
+            .pWaitSemaphoreValues = wait_values.data(),
+            .signalSemaphoreValueCount = 2,
+            .pSignalSemaphoreValues = signal_values,
+        }),
         .waitSemaphoreCount = static_cast<uint32_t>(semaphores.size()),
         .pWaitSemaphores = semaphores.data(),
         .pWaitDstStageMask = stage_flags.data(),
-        .commandBufferCount = 1,
-        .pCommandBuffers = &cmdbuf,
-        .signalSemaphoreCount = 1,
-        .pSignalSemaphores = &slot.present_semaphore,
+        .commandBufferCount = static_cast<uint32_t>(command_buffers.size()),
+        .pCommandBuffers = command_buffers.data(),
+        .signalSemaphoreCount = 2,
+        .pSignalSemaphores = signal_semaphores,
     }), signal_when_reusable);
-
-    addCleanupAction([=, &device]() {
-        vkFreeCommandBuffers(device.device, device.pool, 1, &cmdbuf);
-    });
+    submit_span.end();
+    _impl->timeline_value = timeline_value;
 
     queuePresent();
 }
@@ -118,13 +125,7 @@ void Swapchain::Frame::presentFromImage(VkImage image, VkFence signal_when_reusa
     assert(image != slot.image);
     assert(signal_when_reusable != VK_NULL_HANDLE);
 
-    VkCommandBuffer cmdbuf;
-    vkAllocateCommandBuffers(device.device, tmpPtr((VkCommandBufferAllocateInfo) {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = device.pool,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = 1,
-    }), &cmdbuf);
+    VkCommandBuffer cmdbuf = allocateCommandBuffer();
 
     vkBeginCommandBuffer(cmdbuf, tmpPtr((VkCommandBufferBeginInfo) {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
@@ -206,22 +207,35 @@ void Swapchain::Frame::presentFromImage(VkImage image, VkFence signal_when_reusa
     std::vector<VkPipelineStageFlags> stage_flags;
     for (auto& sem : semaphores)
         stage_flags.emplace_back(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+    std::vector<uint64_t> wait_values;
+    std::vector<VkCommandBuffer> command_buffers = { cmdbuf };
+    _impl->append_waits(semaphores, stage_flags, wait_values, command_buffers);
+
+    uint64_t timeline_value = device.nextTimelineValue();
+    VkSemaphore signal_semaphores[] = { slot.present_semaphore, device.timeline };
+    uint64_t signal_values[] = { 0, timeline_value };
 
     vkEndCommandBuffer(cmdbuf);
+    Tracer::Span submit_span(device, "submit");
     vkQueueSubmit(device.main_queue, 1, tmpPtr((VkSubmitInfo) {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = tmpPtr((VkTimelineSemaphoreSubmitInfo) {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .waitSemaphoreValueCount = static_cast<uint32_t>(wait_values.size()),
+            .pWaitSemaphoreValues = wait_values.data(),
+            .signalSemaphoreValueCount = 2,
+            .pSignalSemaphoreValues = signal_values,
+        }),
         .waitSemaphoreCount = static_cast<uint32_t>(semaphores.size()),
         .pWaitSemaphores = semaphores.data(),
         .pWaitDstStageMask = stage_flags.data(),
-        .commandBufferCount = 1,
-        .pCommandBuffers = &cmdbuf,
-        .signalSemaphoreCount = 1,
-        .pSignalSemaphores = &slot.present_semaphore,
+        .commandBufferCount = static_cast<uint32_t>(command_buffers.size()),
+        .pCommandBuffers = command_buffers.data(),
+        .signalSemaphoreCount = 2,
+        .pSignalSemaphores = signal_semaphores,
     }), signal_when_reusable);
-
-    addCleanupAction([=, &device]() {
-        vkFreeCommandBuffers(device.device, device.pool, 1, &cmdbuf);
-    });
+    submit_span.end();
+    _impl->timeline_value = timeline_value;
 
     queuePresent();
 }
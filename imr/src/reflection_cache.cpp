@@ -0,0 +1,227 @@
+#include "shader_private.h"
+
+#include "imr/util.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+
+namespace imr {
+
+uint64_t hash_spirv_module(const SPIRVModule& module) {
+    // FNV-1a, over the bytes of every word
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (uint32_t word : module) {
+        for (int i = 0; i < 4; i++) {
+            hash ^= (word >> (i * 8)) & 0xff;
+            hash *= 0x100000001b3ull;
+        }
+    }
+    return hash;
+}
+
+namespace {
+
+struct ReflectionKey {
+    uint64_t spirv_hash;
+    uint64_t spirv_size;
+    VkShaderStageFlagBits stage;
+    std::string entry_point;
+
+    bool operator==(const ReflectionKey&) const = default;
+};
+
+struct ReflectionKeyHash {
+    size_t operator()(const ReflectionKey& key) const {
+        return key.spirv_hash ^ (std::hash<std::string>()(key.entry_point) * 31) ^ key.stage;
+    }
+};
+
+/// Reads and writes the cache files, the layout is a flat sequence of little words:
+/// magic, version, the key (hash, size, stage, name), then the push constant ranges and the bindings of every set, each prefixed by a count
+struct ReflectionFile {
+    static const uint32_t magic = 0x46524d49; // "IMRF"
+    static const uint32_t version = 1;
+
+    std::vector<uint32_t> words;
+    size_t cursor = 0;
+
+    void put(uint32_t word) { words.push_back(word); }
+    void put64(uint64_t word) { put(static_cast<uint32_t>(word)); put(static_cast<uint32_t>(word >> 32)); }
+
+    bool get(uint32_t& word) {
+        if (cursor >= words.size())
+            return false;
+        word = words[cursor++];
+        return true;
+    }
+    bool get64(uint64_t& word) {
+        uint32_t lo, hi;
+        if (!get(lo) || !get(hi))
+            return false;
+        word = (static_cast<uint64_t>(hi) << 32) | lo;
+        return true;
+    }
+
+    void write_key(const ReflectionKey& key) {
+        put(magic);
+        put(version);
+        put64(key.spirv_hash);
+        put64(key.spirv_size);
+        put(key.stage);
+        put(static_cast<uint32_t>(key.entry_point.size()));
+        // the name is padded to a whole number of words
+        for (size_t i = 0; i < key.entry_point.size(); i += 4) {
+            uint32_t word = 0;
+            for (size_t j = 0; j < 4 && i + j < key.entry_point.size(); j++)
+                word |= static_cast<uint32_t>(static_cast<uint8_t>(key.entry_point[i + j])) << (j * 8);
+            put(word);
+        }
+    }
+
+    bool matches_key(const ReflectionKey& key) {
+        ReflectionFile expected;
+        expected.write_key(key);
+        if (words.size() < expected.words.size() || !std::equal(expected.words.begin(), expected.words.end(), words.begin()))
+            return false;
+        cursor = expected.words.size();
+        return true;
+    }
+
+    void write_layout(const ReflectedLayout& layout) {
+        put(layout.stages);
+        put(static_cast<uint32_t>(layout.push_constants.size()));
+        for (auto& range : layout.push_constants) {
+            put(range.stageFlags);
+            put(range.offset);
+            put(range.size);
+        }
+        put(static_cast<uint32_t>(layout.set_bindings.size()));
+        for (auto& [set, bindings] : layout.set_bindings) {
+            put(static_cast<uint32_t>(set));
+            put(static_cast<uint32_t>(bindings.size()));
+            for (auto& binding : bindings) {
+                put(binding.binding);
+                put(binding.descriptorType);
+                put(binding.descriptorCount);
+                put(binding.stageFlags);
+            }
+        }
+    }
+
+    bool read_layout(ReflectedLayout& layout) {
+        uint32_t stages, count;
+        if (!get(stages) || !get(count))
+            return false;
+        layout.stages = stages;
+        for (uint32_t i = 0; i < count; i++) {
+            VkPushConstantRange range;
+            if (!get(range.stageFlags) || !get(range.offset) || !get(range.size))
+                return false;
+            layout.push_constants.push_back(range);
+        }
+        if (!get(count))
+            return false;
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t set, binding_count;
+            if (!get(set) || !get(binding_count))
+                return false;
+            auto& bindings = layout.set_bindings[static_cast<int>(set)];
+            for (uint32_t j = 0; j < binding_count; j++) {
+                VkDescriptorSetLayoutBinding binding = {};
+                uint32_t type;
+                if (!get(binding.binding) || !get(type) || !get(binding.descriptorCount) || !get(binding.stageFlags))
+                    return false;
+                binding.descriptorType = static_cast<VkDescriptorType>(type);
+                bindings.push_back(binding);
+            }
+        }
+        return cursor == words.size();
+    }
+};
+
+struct ReflectionCache {
+    std::mutex mutex;
+    std::unordered_map<ReflectionKey, ReflectedLayout, ReflectionKeyHash> layouts;
+    /// Empty unless IMR_REFLECTION_CACHE names a directory to keep the layouts in
+    std::filesystem::path directory;
+
+    ReflectionCache() {
+        if (auto env = getenv("IMR_REFLECTION_CACHE"); env && *env)
+            directory = env;
+    }
+
+    std::filesystem::path file_for(const ReflectionKey& key) {
+        char name[64];
+        snprintf(name, sizeof(name), "%016llx_%x_%016zx.refl", static_cast<unsigned long long>(key.spirv_hash), key.stage, std::hash<std::string>()(key.entry_point));
+        return directory / name;
+    }
+
+    std::optional<ReflectedLayout> load(const ReflectionKey& key) {
+        size_t size;
+        unsigned char* data;
+        if (!imr_read_file(file_for(key).string().c_str(), &size, &data))
+            return std::nullopt;
+        ReflectionFile file;
+        file.words.resize(size / 4);
+        memcpy(file.words.data(), data, file.words.size() * 4);
+        free(data);
+
+        ReflectedLayout layout;
+        if (size % 4 != 0 || !file.matches_key(key) || !file.read_layout(layout))
+            return std::nullopt;
+        return layout;
+    }
+
+    void save(const ReflectionKey& key, const ReflectedLayout& layout) {
+        ReflectionFile file;
+        file.write_key(key);
+        file.write_layout(layout);
+
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        // same as the pipeline cache, never leave a half-written file where a reader could find it
+        auto path = file_for(key);
+        auto tmp_path = path;
+        tmp_path += ".tmp";
+        if (imr_write_file(tmp_path.string().c_str(), file.words.size() * 4, reinterpret_cast<const char*>(file.words.data())))
+            std::filesystem::rename(tmp_path, path, error);
+        else
+            fprintf(stderr, "Failed to save the reflection cache to %s\n", path.string().c_str());
+    }
+};
+
+ReflectionCache& reflection_cache() {
+    static ReflectionCache cache;
+    return cache;
+}
+
+}
+
+ReflectedLayout get_reflected_layout(SPIRVModule& spirv_module, uint64_t spirv_hash, VkShaderStageFlagBits stage, const std::string& entry_point) {
+    auto& cache = reflection_cache();
+    ReflectionKey key = { spirv_hash, spirv_module.size(), stage, entry_point };
+    {
+        std::lock_guard lock(cache.mutex);
+        if (auto found = cache.layouts.find(key); found != cache.layouts.end())
+            return found->second;
+    }
+
+    std::optional<ReflectedLayout> layout;
+    if (!cache.directory.empty())
+        layout = cache.load(key);
+    if (!layout) {
+        // not holding the lock here, so several threads can reflect different modules at once
+        layout = ReflectedLayout(spirv_module, stage);
+        if (!cache.directory.empty())
+            cache.save(key, *layout);
+    }
+
+    std::lock_guard lock(cache.mutex);
+    return cache.layouts.try_emplace(key, std::move(*layout)).first->second;
+}
+
+}
@@ -0,0 +1,368 @@
+#include "swapchain_private.h"
+
+#include <algorithm>
+#include <climits>
+
+namespace imr {
+
+static VkImageCreateInfo transient_image_info(const TransientImagePool::ImageKey& key) {
+    auto [type, width, height, depth, format, usage] = key;
+    return (VkImageCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = type,
+        .format = format,
+        .extent = { width, height, depth },
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+}
+
+TransientImagePool::~TransientImagePool() {
+    for (auto& [key, image] : images)
+        destroy_image(image);
+    for (auto& slot : slots) {
+        if (slot.allocation)
+            vmaFreeMemory(device._impl->allocator, slot.allocation);
+    }
+}
+
+VkMemoryRequirements TransientImagePool::requirements(const ImageKey& key) {
+    if (auto found = requirements_cache.find(key); found != requirements_cache.end()) {
+        found->second.last_used = generation;
+        return found->second.requirements;
+    }
+
+    // a throwaway image tells us, we can't bind the real ones before we know which slot they go in
+    auto info = transient_image_info(key);
+    VkImage probe;
+    CHECK_VK_THROW(vkCreateImage(device.device, &info, nullptr, &probe));
+    VkMemoryRequirements memory_requirements;
+    vkGetImageMemoryRequirements(device.device, probe, &memory_requirements);
+    vkDestroyImage(device.device, probe, nullptr);
+    requirements_cache[key] = { memory_requirements, generation };
+    return memory_requirements;
+}
+
+void TransientImagePool::ensure_slot(size_t index, VkMemoryRequirements memory_requirements) {
+    if (slots.size() <= index)
+        slots.resize(index + 1);
+    slots_used = std::max(slots_used, index + 1);
+    auto& slot = slots[index];
+    // way too big is no good either, that's memory a smaller window doesn't get back
+    bool fits = slot.size >= memory_requirements.size && slot.size <= memory_requirements.size * 2;
+    if (slot.allocation && fits && (memory_requirements.memoryTypeBits & (1u << slot.memory_type)) && slot.offset % memory_requirements.alignment == 0)
+        return;
+
+    // The images bound to the old memory go along with it
+    for (auto i = images.begin(); i != images.end();) {
+        if (std::get<1>(i->first) == index) {
+            destroy_image(i->second);
+            i = images.erase(i);
+        } else {
+            i++;
+        }
+    }
+    if (slot.allocation)
+        vmaFreeMemory(device._impl->allocator, slot.allocation);
+
+    VmaAllocationInfo allocation_info;
+    CHECK_VK_THROW(vmaAllocateMemory(device._impl->allocator, &memory_requirements, tmpPtr((VmaAllocationCreateInfo) {
+        .requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+    }), &slot.allocation, &allocation_info));
+    slot.size = memory_requirements.size;
+    slot.memory_type = allocation_info.memoryType;
+    slot.offset = allocation_info.offset;
+}
+
+Image& TransientImagePool::get_image(const ImageKey& key, size_t slot) {
+    auto& pooled = images[{ key, slot }];
+    pooled.last_used = generation;
+    if (!pooled.image) {
+        auto info = transient_image_info(key);
+        CHECK_VK_THROW(vkCreateImage(device.device, &info, nullptr, &pooled.handle));
+        CHECK_VK_THROW(vmaBindImageMemory(device._impl->allocator, slots[slot].allocation, pooled.handle));
+        pooled.image = std::make_unique<Image>(make_image_from(device, pooled.handle, info.imageType, info.extent, info.format, info.usage));
+    }
+    return *pooled.image;
+}
+
+void TransientImagePool::destroy_image(PooledImage& pooled) {
+    // the views go first
+    pooled.image.reset();
+    vkDestroyImage(device.device, pooled.handle, nullptr);
+}
+
+void TransientImagePool::evict_unused() {
+    for (auto i = images.begin(); i != images.end();) {
+        if (i->second.last_used != generation || std::get<1>(i->first) >= slots_used) {
+            destroy_image(i->second);
+            i = images.erase(i);
+        } else {
+            i++;
+        }
+    }
+    for (size_t slot = slots_used; slot < slots.size(); slot++) {
+        if (slots[slot].allocation)
+            vmaFreeMemory(device._impl->allocator, slots[slot].allocation);
+    }
+    slots.resize(slots_used);
+    std::erase_if(requirements_cache, [&](auto& entry) { return entry.second.last_used != generation; });
+
+    generation++;
+    slots_used = 0;
+}
+
+struct RenderGraph::Impl {
+    Swapchain::SimplifiedRenderContext& context;
+    Device& device;
+
+    struct ImageResource {
+        /// Transient images only get one in execute()
+        Image* image = nullptr;
+        bool transient = false;
+        TransientImagePool::ImageKey key;
+
+        /// Where the image is used, in execution order
+        int first_use = INT_MAX;
+        int last_use = -1;
+        bool used_on_main = false;
+        bool used_async = false;
+        /// The transient image that had the memory before this one, this frame
+        std::optional<ImageId> previous_in_slot;
+        /// Whether the first pass to use it was recorded yet
+        bool live = false;
+    };
+    std::vector<ImageResource> images;
+    std::deque<Pass> passes;
+    bool executed = false;
+
+    Impl(Swapchain::SimplifiedRenderContext& context) : context(context), device(context.frame()._impl->device) {}
+
+    static bool conflicts(const Pass& a, const Pass& b);
+    void assign_transient_memory(const std::vector<Pass*>& main_order);
+    void record(Pass& pass, VkCommandBuffer, BarrierBatcher&, RenderGraph&);
+};
+
+RenderGraph::RenderGraph(Swapchain::SimplifiedRenderContext& context) {
+    _impl = std::make_unique<Impl>(context);
+}
+
+RenderGraph::~RenderGraph() = default;
+
+RenderGraph::ImageId RenderGraph::importImage(Image& image) {
+    _impl->images.push_back({ .image = &image });
+    return static_cast<ImageId>(_impl->images.size() - 1);
+}
+
+RenderGraph::ImageId RenderGraph::createImage(VkImageType type, VkExtent3D size, VkFormat format, VkImageUsageFlags usage) {
+    _impl->images.push_back({
+        .transient = true,
+        .key = { type, size.width, size.height, size.depth, format, usage },
+    });
+    return static_cast<ImageId>(_impl->images.size() - 1);
+}
+
+RenderGraph::Pass& RenderGraph::Pass::use(ImageId image, VkPipelineStageFlags2 stage, VkAccessFlags2 access, VkImageLayout layout) {
+    uses.push_back({ image, stage, access, layout });
+    return *this;
+}
+
+RenderGraph::Pass& RenderGraph::addPass(std::string name, Queue queue, std::function<void(PassContext&)>&& record) {
+    assert(!_impl->executed);
+    return _impl->passes.emplace_back((Pass) {
+        .name = std::move(name),
+        .queue = queue,
+        .record = std::move(record),
+    });
+}
+
+Image& RenderGraph::image(ImageId id) {
+    auto image = _impl->images[id].image;
+    if (!image)
+        throw std::runtime_error("Transient images only exist once the graph executes");
+    return *image;
+}
+
+void RenderGraph::PassContext::barrier() {
+    for (auto& use : pass.uses)
+        barriers.require(graph.image(use.image), use.stage, use.access, use.layout);
+    barriers.flush();
+}
+
+bool RenderGraph::Impl::conflicts(const Pass& a, const Pass& b) {
+    for (auto& use_a : a.uses) {
+        for (auto& use_b : b.uses) {
+            if (use_a.image != use_b.image)
+                continue;
+            if ((use_a.access | use_b.access) & write_access_flags || use_a.layout != use_b.layout)
+                return true;
+        }
+    }
+    return false;
+}
+
+void RenderGraph::Impl::assign_transient_memory(const std::vector<Pass*>& main_order) {
+    for (int position = 0; position < (int) main_order.size(); position++) {
+        for (auto& use : main_order[position]->uses) {
+            auto& resource = images[use.image];
+            resource.first_use = std::min(resource.first_use, position);
+            resource.last_use = std::max(resource.last_use, position);
+        }
+    }
+
+    std::vector<ImageId> transients;
+    for (ImageId id = 0; id < images.size(); id++) {
+        auto& resource = images[id];
+        if (!resource.transient || !(resource.used_on_main || resource.used_async))
+            continue;
+        // the async work overlaps with the main queue, so there's no telling when those are done with
+        if (resource.used_async) {
+            resource.first_use = -1;
+            resource.last_use = INT_MAX;
+        }
+        transients.push_back(id);
+    }
+    std::sort(transients.begin(), transients.end(), [&](ImageId a, ImageId b) { return images[a].first_use < images[b].first_use; });
+
+    // Greedily put each image in the first slot whose current occupant is done by the time the image is needed
+    struct SlotUse {
+        ImageId last;
+        VkMemoryRequirements requirements;
+    };
+    std::vector<SlotUse> slot_uses;
+    std::vector<size_t> slot_of(images.size());
+    auto& pool = context.frame()._impl->in_flight.transient_images;
+    if (!pool)
+        pool = std::make_unique<TransientImagePool>(device);
+    for (auto id : transients) {
+        auto& resource = images[id];
+        auto requirements = pool->requirements(resource.key);
+        size_t slot = 0;
+        for (; slot < slot_uses.size(); slot++) {
+            auto& slot_use = slot_uses[slot];
+            if (images[slot_use.last].last_use < resource.first_use && (slot_use.requirements.memoryTypeBits & requirements.memoryTypeBits))
+                break;
+        }
+        if (slot == slot_uses.size()) {
+            slot_uses.push_back({ id, requirements });
+        } else {
+            auto& slot_use = slot_uses[slot];
+            resource.previous_in_slot = slot_use.last;
+            slot_use.last = id;
+            slot_use.requirements.size = std::max(slot_use.requirements.size, requirements.size);
+            slot_use.requirements.alignment = std::max(slot_use.requirements.alignment, requirements.alignment);
+            slot_use.requirements.memoryTypeBits &= requirements.memoryTypeBits;
+        }
+        slot_of[id] = slot;
+    }
+
+    for (size_t slot = 0; slot < slot_uses.size(); slot++)
+        pool->ensure_slot(slot, slot_uses[slot].requirements);
+    for (auto id : transients)
+        images[id].image = &pool->get_image(images[id].key, slot_of[id]);
+}
+
+void RenderGraph::Impl::record(Pass& pass, VkCommandBuffer cmdbuf, BarrierBatcher& barriers, RenderGraph& graph) {
+    for (auto& use : pass.uses) {
+        auto& resource = images[use.image];
+        if (resource.transient && !resource.live) {
+            // The memory might have held another image earlier in the frame, we have to wait for it to be done with
+            auto& state = resource.image->state();
+            ResourceState previous = resource.previous_in_slot ? images[*resource.previous_in_slot].image->state() : ResourceState {};
+            state = {
+                .layout = VK_IMAGE_LAYOUT_UNDEFINED,
+                .write_stages = previous.write_stages | previous.read_stages,
+                .write_access = previous.write_access,
+            };
+            resource.live = true;
+        }
+        barriers.require(*resource.image, use.stage, use.access, use.layout);
+    }
+    barriers.flush();
+
+    PassContext context = { graph, pass, cmdbuf, barriers };
+    pass.record(context);
+}
+
+void RenderGraph::execute() {
+    assert(!_impl->executed);
+    _impl->executed = true;
+    auto& images = _impl->images;
+    auto& passes = _impl->passes;
+
+    // Async passes that break the rules go on the main queue.
+    // The contents are discarded on the way over, which is only fine for a first use that doesn't read them, or if there weren't any to begin with.
+    for (auto& pass : passes) {
+        if (pass.queue == Queue::ASYNC_COMPUTE) {
+            bool fits = std::all_of(pass.uses.begin(), pass.uses.end(), [&](auto& use) {
+                auto& resource = images[use.image];
+                bool write_only = (use.access & write_access_flags) && !(use.access & ~write_access_flags);
+                return !resource.used_on_main && (resource.used_async || resource.transient || write_only);
+            });
+            if (!fits)
+                pass.queue = Queue::MAIN;
+        }
+        for (auto& use : pass.uses) {
+            if (pass.queue == Queue::MAIN)
+                images[use.image].used_on_main = true;
+            else
+                images[use.image].used_async = true;
+        }
+    }
+
+    // Main passes that depend on async ones, directly or not, have to wait for the async work. The others go ahead of it.
+    std::vector<Pass*> before_async, async, after_async;
+    std::vector<bool> waits(passes.size());
+    for (size_t i = 0; i < passes.size(); i++) {
+        auto& pass = passes[i];
+        if (pass.queue == Queue::ASYNC_COMPUTE) {
+            async.push_back(&pass);
+            continue;
+        }
+        for (size_t j = 0; j < i && !waits[i]; j++) {
+            if ((passes[j].queue == Queue::ASYNC_COMPUTE || waits[j]) && Impl::conflicts(passes[j], pass))
+                waits[i] = true;
+        }
+        (waits[i] ? after_async : before_async).push_back(&pass);
+    }
+    std::vector<Pass*> main_order = before_async;
+    main_order.insert(main_order.end(), after_async.begin(), after_async.end());
+    _impl->assign_transient_memory(main_order);
+
+    auto& context = _impl->context;
+    BarrierBatcher barriers(_impl->device, context.cmdbuf());
+    for (auto pass : before_async)
+        _impl->record(*pass, context.cmdbuf(), barriers, *this);
+
+    if (!async.empty()) {
+        // otherwise what we recorded so far would wait on the async work too
+        if (!before_async.empty()) {
+            context.flush();
+            barriers.setCommandBuffer(context.cmdbuf());
+        }
+
+        // submitAsyncCompute transitions the images on the way in and out, and keeps their state up to date
+        std::vector<Image*> async_images;
+        for (auto& resource : images) {
+            if (!resource.used_async)
+                continue;
+            async_images.push_back(resource.image);
+            resource.live = true;
+        }
+        context.frame().submitAsyncCompute([&](VkCommandBuffer cmdbuf) {
+            BarrierBatcher async_barriers(_impl->device, cmdbuf);
+            for (auto pass : async)
+                _impl->record(*pass, cmdbuf, async_barriers, *this);
+        }, async_images);
+    }
+
+    for (auto pass : after_async)
+        _impl->record(*pass, context.cmdbuf(), barriers, *this);
+}
+
+}
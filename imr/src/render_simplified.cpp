@@ -1,18 +1,25 @@
-#include "imr/imr.h"
+#include "swapchain_private.h"
 
 namespace imr {
 
 struct SimplifiedRenderContextImpl : Swapchain::SimplifiedRenderContext {
     Swapchain::Frame& frame_;
     VkCommandBuffer command_buffer;
+    /// Only the first submission waits on the swapchain image
+    bool waited_for_image = false;
 
-    SimplifiedRenderContextImpl(Swapchain::Frame& frame, VkCommandBuffer cmdbuf) : frame_(frame), command_buffer(cmdbuf) {};
+    SimplifiedRenderContextImpl(Swapchain::Frame& frame) : frame_(frame) {};
 
     Image& image() const override;
     VkCommandBuffer cmdbuf() const override;
     Swapchain::Frame& frame() const override;
 
     void addCleanupAction(std::function<void(void)>&& fn) override;
+    void flush() override;
+
+    void begin();
+    /// The last submission lets the swapchain know the image is ready, and signals the timeline for the frame
+    void submit(bool last);
 };
 
 Image& SimplifiedRenderContextImpl::image() const { return frame_.image(); }
@@ -23,6 +30,125 @@ void SimplifiedRenderContextImpl::addCleanupAction(std::function<void()>&& fn) {
     frame_.addCleanupAction(std::move(fn));
 }
 
+void SimplifiedRenderContextImpl::flush() {
+    submit(false);
+    begin();
+}
+
+void SimplifiedRenderContextImpl::begin() {
+    // Grab a command buffer from the frame's pool and begin recording it
+    command_buffer = frame_.allocateCommandBuffer();
+    vkBeginCommandBuffer(command_buffer, tmpPtr((VkCommandBufferBeginInfo) {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    }));
+}
+
+void SimplifiedRenderContextImpl::submit(bool last) {
+    auto& device = frame_._impl->device;
+
+    // The submission signals the device timeline so we know when the cmdbuf is done, and when the frame can be recycled
+    std::vector<VkSemaphore> signal_semaphores;
+    std::vector<uint64_t> signal_values;
+    uint64_t timeline_value = 0;
+    if (last) {
+        timeline_value = device.nextTimelineValue();
+        signal_semaphores = { frame_.signal_when_ready, device.timeline };
+        // the value for the binary semaphore is ignored
+        signal_values = { 0, timeline_value };
+    }
+
+    // We wait on the swapchain image, and whatever else the user asked for
+    std::vector<VkSemaphore> wait_semaphores;
+    std::vector<VkPipelineStageFlags> wait_stages;
+    if (!waited_for_image) {
+        wait_semaphores.push_back(frame_.swapchain_image_available);
+        wait_stages.push_back(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+        waited_for_image = true;
+    }
+    std::vector<uint64_t> wait_values;
+    std::vector<VkCommandBuffer> command_buffers = { command_buffer };
+    frame_._impl->append_waits(wait_semaphores, wait_stages, wait_values, command_buffers);
+
+    // Finish the cmdbuf and submit it to the GPU
+    // before: wait on the swapchain image to be available
+    // after: notify the swapchain that the image can be shown
+    vkEndCommandBuffer(command_buffer);
+    Tracer::Span submit_span(device, "submit");
+    vkQueueSubmit(device.main_queue, 1, tmpPtr((VkSubmitInfo) {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = tmpPtr((VkTimelineSemaphoreSubmitInfo) {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .waitSemaphoreValueCount = static_cast<uint32_t>(wait_values.size()),
+            .pWaitSemaphoreValues = wait_values.data(),
+            .signalSemaphoreValueCount = static_cast<uint32_t>(signal_values.size()),
+            .pSignalSemaphoreValues = signal_values.data(),
+        }),
+        .waitSemaphoreCount = static_cast<uint32_t>(wait_semaphores.size()),
+        .pWaitSemaphores = wait_semaphores.data(),
+        .pWaitDstStageMask = wait_stages.data(),
+        .commandBufferCount = static_cast<uint32_t>(command_buffers.size()),
+        .pCommandBuffers = command_buffers.data(),
+        .signalSemaphoreCount = static_cast<uint32_t>(signal_semaphores.size()),
+        .pSignalSemaphores = signal_semaphores.data(),
+    }), VK_NULL_HANDLE);
+    submit_span.end();
+    if (last)
+        frame_._impl->timeline_value = timeline_value;
+}
+
+/// Copies the frame into a host-visible buffer, and hands it to onFrameReadback once the frame has retired
+static void record_readback(Swapchain& swapchain, Swapchain::Frame& frame, VkCommandBuffer cmdbuf, BarrierBatcher& barriers) {
+    auto& device = swapchain.device();
+    auto& image = frame.image();
+    auto& in_flight = frame._impl->in_flight;
+
+    VkExtent2D extent = { image.size().width, image.size().height };
+    // the swapchain is always 8-bit RGBA or BGRA
+    size_t size = static_cast<size_t>(extent.width) * extent.height * 4;
+    // the frame that used this buffer before us has retired, so it's safe to replace
+    if (!in_flight.readback_buffer || in_flight.readback_buffer->size != size)
+        in_flight.readback_buffer = std::make_unique<Buffer>(device, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    auto& buffer = *in_flight.readback_buffer;
+
+    barriers.require(image, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT);
+    barriers.require(buffer, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+    barriers.flush();
+
+    vkCmdCopyImageToBuffer2(cmdbuf, tmpPtr((VkCopyImageToBufferInfo2) {
+        .sType = VK_STRUCTURE_TYPE_COPY_IMAGE_TO_BUFFER_INFO_2,
+        .srcImage = image.handle(),
+        .srcImageLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .dstBuffer = buffer.handle,
+        .regionCount = 1,
+        .pRegions = tmpPtr((VkBufferImageCopy2) {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_IMAGE_COPY_2,
+            .bufferOffset = 0,
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = 0,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+            .imageOffset = { 0, 0, 0 },
+            .imageExtent = image.size(),
+        }),
+    }));
+
+    // goes out with the barrier for presenting
+    barriers.require(buffer, VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
+
+    // Runs once the frame has retired, without stalling the frame loop
+    size_t frame_id = frame.id;
+    frame.addCleanupAction([&swapchain, &buffer, frame_id, extent]() {
+        buffer.invalidate();
+        if (swapchain.onFrameReadback)
+            swapchain.onFrameReadback(frame_id, extent, buffer.mapped().data());
+    });
+}
+
 void Swapchain::renderFrameSimplified(std::function<void(SimplifiedRenderContext&)>&& fn) {
     auto& device = this->device();
     auto& vk = device.dispatch;
@@ -30,18 +156,9 @@ void Swapchain::renderFrameSimplified(std::function<void(SimplifiedRenderContext
     beginFrame([&](Frame& frame) {
         auto& image = frame.image();
 
-        // Allocate and begin recording a command buffer
-        VkCommandBuffer cmdbuf;
-        vkAllocateCommandBuffers(device.device, tmpPtr((VkCommandBufferAllocateInfo) {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-            .commandPool = device.pool,
-            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-            .commandBufferCount = 1,
-        }), &cmdbuf);
-        vkBeginCommandBuffer(cmdbuf, tmpPtr((VkCommandBufferBeginInfo) {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-        }));
+        SimplifiedRenderContextImpl context(frame);
+        context.begin();
+        VkCommandBuffer cmdbuf = context.cmdbuf();
 
         // This barrier transitions the image from an unknown state into the "general" layout so we can render to it.
         // before the barrier: nothing relevant happens
@@ -55,66 +172,39 @@ void Swapchain::renderFrameSimplified(std::function<void(SimplifiedRenderContext
                 .srcStageMask = VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT,
                 .srcAccessMask = VK_ACCESS_2_NONE,
                 .dstStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-                .dstAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT,
                 .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
                 .newLayout = VK_IMAGE_LAYOUT_GENERAL,
                 .image = image.handle(),
                 .subresourceRange = image.whole_image_subresource_range(),
             }),
         }));
+        // We don't know what the user code does with the image. If it goes through a BarrierBatcher, that narrows this down,
+        // otherwise the final barrier has to assume it could have been anything.
+        image.state() = {
+            .layout = VK_IMAGE_LAYOUT_GENERAL,
+            .write_stages = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            .write_access = VK_ACCESS_2_MEMORY_WRITE_BIT,
+            .visible_stages = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            .visible_access = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT,
+            .read_stages = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        };
 
         // Run user code
-        SimplifiedRenderContextImpl context(frame, cmdbuf);
         fn(context);
+        // it might have flushed and moved on to another command buffer
+        cmdbuf = context.cmdbuf();
 
-        // This barrier transitions the image from the "general" layout into the "present src" layout so it can be shown
-        // before the barrier: all writes from any pipeline stage
-        // after the barrier: all reads from the present stage
-        vk.cmdPipelineBarrier2KHR(cmdbuf, tmpPtr((VkDependencyInfo) {
-            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-            .dependencyFlags = 0,
-            .imageMemoryBarrierCount = 1,
-            .pImageMemoryBarriers = tmpPtr((VkImageMemoryBarrier2) {
-                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
-                .srcStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-                .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
-                .dstStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-                .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
-                .oldLayout = VK_IMAGE_LAYOUT_GENERAL,
-                .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-                .image = image.handle(),
-                .subresourceRange = image.whole_image_subresource_range()
-            }),
-        }));
+        BarrierBatcher barriers(device, cmdbuf);
+        if (onFrameReadback && _impl->can_read_back)
+            record_readback(*this, frame, cmdbuf, barriers);
+
+        // This barrier transitions the image from the "general" layout into the "present src" layout so it can be shown.
+        // It waits on whatever the image went through last, the swapchain's semaphore takes it from there.
+        barriers.require(image, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+        barriers.flush();
 
-        // Create a fence so we can track the execution of the cmdbuf
-        VkFence fence;
-        vkCreateFence(device.device, tmpPtr((VkFenceCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-            .flags = 0,
-        }), nullptr, &fence);
-
-        // Finish the cmdbuf and submit it to the GPU, and pass the fence so we're notified when it's done
-        // before: wait on the swapchain image to be available
-        // after: notify the swapchain that the image can be shown
-        vkEndCommandBuffer(cmdbuf);
-        vkQueueSubmit(device.main_queue, 1, tmpPtr((VkSubmitInfo) {
-            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-            .waitSemaphoreCount = 1,
-            .pWaitSemaphores = &frame.swapchain_image_available,
-            .pWaitDstStageMask = tmpPtr((VkPipelineStageFlags) VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT),
-            .commandBufferCount = 1,
-            .pCommandBuffers = &cmdbuf,
-            .signalSemaphoreCount = 1,
-            .pSignalSemaphores = &frame.signal_when_ready,
-        }), fence);
-
-        // cleanup those objects once the cmdbuf has executed
-        frame.addCleanupFence(fence);
-        frame.addCleanupAction([=, &device]() {
-            vkDestroyFence(device.device, fence, nullptr);
-            vkFreeCommandBuffers(device.device, device.pool, 1, &cmdbuf);
-        });
+        context.submit(true);
 
         frame.queuePresent();
     });
@@ -3,8 +3,6 @@
 namespace imr {
 
 void Swapchain::Frame::withRenderTargets(VkCommandBuffer cmdbuf, std::vector<Image*> color_images, Image* depth, std::function<void()> f) {
-    auto& device = _impl->slot.swapchain._impl->device;
-
     std::vector<VkImageView> color_views;
     color_views.resize(color_images.size());
     size_t i = 0;
@@ -19,38 +17,16 @@ void Swapchain::Frame::withRenderTargets(VkCommandBuffer cmdbuf, std::vector<Ima
         }
     };
 
+    // the views are cached by the images, so rendering to the same targets every frame doesn't create any
     for (auto color_image : color_images) {
-        vkCreateImageView(device.device, tmpPtr((VkImageViewCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-            .image = color_image->handle(),
-            .viewType = VK_IMAGE_VIEW_TYPE_2D,
-            .format = color_image->format(),
-            .subresourceRange = color_image->whole_image_subresource_range(),
-        }), nullptr, &color_views.data()[i]);
-
+        color_views[i++] = color_image->view(VK_IMAGE_VIEW_TYPE_2D);
         set_size(color_image->size());
-
-        addCleanupAction([=,&device]() {
-            vkDestroyImageView(device.device, color_views.data()[i], nullptr);
-        });
-        i++;
     }
 
     VkImageView depth_view = VK_NULL_HANDLE;
     if (depth) {
-        vkCreateImageView(device.device, tmpPtr((VkImageViewCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-            .image = depth->handle(),
-            .viewType = VK_IMAGE_VIEW_TYPE_2D,
-            .format = depth->format(),
-            .subresourceRange = depth->whole_image_subresource_range(),
-        }), nullptr, &depth_view);
-
+        depth_view = depth->view(VK_IMAGE_VIEW_TYPE_2D);
         set_size(depth->size());
-
-        addCleanupAction([=, &device]() {
-            vkDestroyImageView(device.device, depth_view, nullptr);
-        });
     }
 
     assert(size);
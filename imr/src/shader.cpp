@@ -13,7 +13,10 @@ extern "C" {
 
 }
 
+#include <algorithm>
+#include <cstring>
 #include <filesystem>
+#include <unordered_map>
 
 namespace imr {
 
@@ -127,23 +130,173 @@ ReflectedLayout::ReflectedLayout(imr::ReflectedLayout& a, imr::ReflectedLayout&
     }
 }
 
-PipelineLayout::PipelineLayout(imr::Device& device, imr::ReflectedLayout& reflected_layout) : device(device) {
+std::map<uint32_t, uint32_t> reflect_specialization_constants(const SPIRVModule& module) {
+    // shady doesn't keep the SpecId decorations around, but they're easy enough to find in the instruction stream
+    std::unordered_map<uint32_t, uint32_t> spec_ids;
+    std::unordered_map<uint32_t, uint32_t> type_sizes;
+    std::unordered_map<uint32_t, uint32_t> constant_types;
+    for (size_t i = 5; i < module.size();) {
+        uint32_t opcode = module[i] & 0xffff;
+        uint32_t count = module[i] >> 16;
+        if (count == 0 || i + count > module.size())
+            throw std::runtime_error("Malformed SPIR-V module");
+        const uint32_t* operands = &module[i + 1];
+        switch (opcode) {
+            case 71: // OpDecorate
+                if (count >= 4 && operands[1] == 1) // SpecId
+                    spec_ids[operands[0]] = operands[2];
+                break;
+            case 20: // OpTypeBool, passed as a VkBool32
+                type_sizes[operands[0]] = sizeof(VkBool32);
+                break;
+            case 21: // OpTypeInt
+            case 22: // OpTypeFloat
+                type_sizes[operands[0]] = operands[1] / 8;
+                break;
+            case 48: // OpSpecConstantTrue
+            case 49: // OpSpecConstantFalse
+            case 50: // OpSpecConstant
+                constant_types[operands[1]] = operands[0];
+                break;
+            default: break;
+        }
+        i += count;
+    }
+
+    std::map<uint32_t, uint32_t> sizes;
+    for (auto [result, spec_id] : spec_ids) {
+        if (constant_types.contains(result))
+            sizes[spec_id] = type_sizes[constant_types[result]];
+    }
+    return sizes;
+}
+
+PackedSpecialization::PackedSpecialization(const ShaderModule& module, const SpecializationConstants& constants) noexcept(false) {
+    auto& sizes = module._impl->specialization_sizes;
+    for (auto& [id, value] : constants) {
+        auto found = sizes.find(id);
+        if (found == sizes.end())
+            throw std::runtime_error("No specialization constant with constant_id " + std::to_string(id));
+
+        std::vector<std::byte> bytes = std::visit([](auto v) {
+            std::vector<std::byte> bytes;
+            if constexpr (std::is_same_v<decltype(v), bool>) {
+                VkBool32 b = v ? VK_TRUE : VK_FALSE;
+                bytes.resize(sizeof(b));
+                memcpy(bytes.data(), &b, sizeof(b));
+            } else {
+                bytes.resize(sizeof(v));
+                memcpy(bytes.data(), &v, sizeof(v));
+            }
+            return bytes;
+        }, value);
+        if (bytes.size() != found->second)
+            throw std::runtime_error("Specialization constant " + std::to_string(id) + " is " + std::to_string(found->second) + " bytes in the shader, not " + std::to_string(bytes.size()));
+
+        entries.push_back((VkSpecializationMapEntry) {
+            .constantID = id,
+            .offset = static_cast<uint32_t>(data.size()),
+            .size = bytes.size(),
+        });
+        data.insert(data.end(), bytes.begin(), bytes.end());
+    }
+    info = {
+        .mapEntryCount = static_cast<uint32_t>(entries.size()),
+        .pMapEntries = entries.data(),
+        .dataSize = data.size(),
+        .pData = data.data(),
+    };
+}
+
+const VkSpecializationInfo* PackedSpecialization::get() const {
+    return entries.empty() ? nullptr : &info;
+}
+
+/// The heap's layout replaces the shader's in its set, so anything the shader declares there has to be in the heap
+static void check_bindless_bindings(const std::vector<VkDescriptorSetLayoutBinding>& bindings) {
+    for (auto& binding : bindings) {
+        bool matches = (binding.binding == BindlessHeap::storage_images_binding && binding.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE)
+            || (binding.binding == BindlessHeap::sampled_images_binding && binding.descriptorType == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE)
+            || (binding.binding == BindlessHeap::samplers_binding && binding.descriptorType == VK_DESCRIPTOR_TYPE_SAMPLER);
+        if (!matches)
+            throw std::runtime_error("Binding " + std::to_string(binding.binding) + " of set " + std::to_string(BindlessHeap::set) + " doesn't match the bindless heap the pipeline asked for");
+    }
+}
+
+PipelineLayout::PipelineLayout(imr::Device& device, imr::ReflectedLayout& reflected_layout, VkPipelineBindPoint bind_point, const PipelineOptions& options) : device(device) {
     int max_set = 0;
     for (auto& [set, value] : reflected_layout.set_bindings) {
         if (set > max_set)
             max_set = set;
     }
+    descriptor_buffer = device._impl->use_descriptor_buffers(device);
+    if (descriptor_buffer && !device.descriptor_buffer_supported)
+        throw std::runtime_error("Descriptor buffers were asked for, but VK_EXT_descriptor_buffer isn't enabled");
+    if (descriptor_buffer && options.bindless)
+        throw std::runtime_error("The bindless heap doesn't work with descriptor buffers");
+
+    bindless = options.bindless;
+    if (auto found = reflected_layout.set_bindings.find(BindlessHeap::set); bindless && found != reflected_layout.set_bindings.end())
+        check_bindless_bindings(found->second);
+    if (bindless && max_set < (int) BindlessHeap::set)
+        max_set = BindlessHeap::set;
     assert(max_set < 32);
     set_layouts.resize(max_set + 1);
+    set_pool_sizes.resize(max_set + 1);
+
+    // Only one set per layout can be pushed, we use the first that fits.
+    // Sets allocated by hand from set_layout() can't be bound to a push set, so that's only done when the pipeline asks for it.
+    uint32_t max_push_descriptors = descriptor_buffer || !options.push_descriptors ? 0 : device._impl->max_push_descriptors;
+    if (max_push_descriptors) {
+        for (unsigned set = 0; set < max_set + 1 && !push_set; set++) {
+            if (bindless && set == BindlessHeap::set)
+                continue;
+            uint32_t count = 0;
+            for (auto& binding : reflected_layout.set_bindings[set])
+                count += binding.descriptorCount;
+            if (count > 0 && count <= max_push_descriptors)
+                push_set = set;
+        }
+    }
+
     for (unsigned set = 0; set < max_set + 1; set++) {
+        if (bindless && set == BindlessHeap::set) {
+            set_layouts[set] = bindless->set_layout();
+            continue;
+        }
         auto& bindings = reflected_layout.set_bindings[set];
+        for (auto& binding : bindings) {
+            auto& sizes = set_pool_sizes[set];
+            auto found = std::find_if(sizes.begin(), sizes.end(), [&](auto& size) { return size.type == binding.descriptorType; });
+            if (found == sizes.end())
+                sizes.push_back({ binding.descriptorType, binding.descriptorCount });
+            else
+                found->descriptorCount += binding.descriptorCount;
+        }
+        VkDescriptorSetLayoutCreateFlags flags = 0;
+        if (push_set == set)
+            flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR;
+        if (descriptor_buffer)
+            flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT;
         CHECK_VK_THROW(vkCreateDescriptorSetLayout(device.device, tmpPtr((VkDescriptorSetLayoutCreateInfo) {
             .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+            .flags = flags,
             .bindingCount = static_cast<uint32_t>(bindings.size()),
             .pBindings = bindings.data(),
         }), nullptr, &set_layouts[set]));
     }
 
+    // The bind helpers lay the sets out back to back in their descriptor buffer range
+    if (descriptor_buffer) {
+        VkDeviceSize alignment = device._impl->descriptor_buffer_properties.descriptorBufferOffsetAlignment;
+        for (auto set_layout : set_layouts) {
+            VkDeviceSize size;
+            device.dispatch.getDescriptorSetLayoutSizeEXT(set_layout, &size);
+            set_offsets.push_back(descriptor_buffer_size);
+            descriptor_buffer_size += (size + alignment - 1) / alignment * alignment;
+        }
+    }
+
     CHECK_VK_THROW(vkCreatePipelineLayout(device.device, tmpPtr((VkPipelineLayoutCreateInfo) {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
         .setLayoutCount = static_cast<uint32_t>(set_layouts.size()),
@@ -151,12 +304,55 @@ PipelineLayout::PipelineLayout(imr::Device& device, imr::ReflectedLayout& reflec
         .pushConstantRangeCount = static_cast<uint32_t>(reflected_layout.push_constants.size()),
         .pPushConstantRanges = reflected_layout.push_constants.data()
     }), nullptr, &pipeline_layout));
+
+    // Lets the bind helpers apply all of a set's writes at once
+    update_templates.resize(set_layouts.size());
+    for (unsigned set = 0; set < max_set + 1 && !descriptor_buffer; set++) {
+        if (bindless && set == BindlessHeap::set)
+            continue;
+        auto& bindings = reflected_layout.set_bindings[set];
+        bool single_descriptors = std::all_of(bindings.begin(), bindings.end(), [](auto& binding) { return binding.descriptorCount == 1; });
+        if (bindings.empty() || !single_descriptors)
+            continue;
+
+        auto& update_template = update_templates[set];
+        std::vector<VkDescriptorUpdateTemplateEntry> entries;
+        for (auto& binding : bindings) {
+            update_template.binding_offsets[binding.binding] = update_template.data_size;
+            entries.push_back((VkDescriptorUpdateTemplateEntry) {
+                .dstBinding = binding.binding,
+                .descriptorCount = 1,
+                .descriptorType = binding.descriptorType,
+                .offset = update_template.data_size,
+                .stride = sizeof(DescriptorTemplateSlot),
+            });
+            update_template.data_size += sizeof(DescriptorTemplateSlot);
+        }
+        CHECK_VK_THROW(vkCreateDescriptorUpdateTemplate(device.device, tmpPtr((VkDescriptorUpdateTemplateCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO,
+            .descriptorUpdateEntryCount = static_cast<uint32_t>(entries.size()),
+            .pDescriptorUpdateEntries = entries.data(),
+            .templateType = push_set == set ? VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR : VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET,
+            .descriptorSetLayout = set_layouts[set],
+            .pipelineBindPoint = bind_point,
+            .pipelineLayout = pipeline_layout,
+            .set = set,
+        }), nullptr, &update_template.handle));
+    }
 }
 
 PipelineLayout::~PipelineLayout() {
+    for (auto& update_template : update_templates) {
+        if (update_template.handle)
+            vkDestroyDescriptorUpdateTemplate(device.device, update_template.handle, nullptr);
+    }
     vkDestroyPipelineLayout(device.device, pipeline_layout, nullptr);
-    for (auto set_layout : set_layouts)
-        vkDestroyDescriptorSetLayout(device.device, set_layout, nullptr);
+    for (unsigned set = 0; set < set_layouts.size(); set++) {
+        // that one belongs to the heap
+        if (bindless && set == BindlessHeap::set)
+            continue;
+        vkDestroyDescriptorSetLayout(device.device, set_layouts[set], nullptr);
+    }
 }
 
 ShaderModule::ShaderModule(imr::Device& device, std::string&& spirv_filename) noexcept(false) {
@@ -166,6 +362,8 @@ ShaderModule::ShaderModule(imr::Device& device, std::string&& spirv_filename) no
 
 ShaderModule::Impl::Impl(imr::Device& device, imr::SPIRVModule&& spirv_module) noexcept(false) : device(device), spirv_module(std::move(spirv_module)) {
     assert(this->spirv_module.size() > 0);
+    spirv_hash = hash_spirv_module(this->spirv_module);
+    specialization_sizes = reflect_specialization_constants(this->spirv_module);
     CHECK_VK(vkCreateShaderModule(device.device, tmpPtr((VkShaderModuleCreateInfo) {
             .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
             .flags = 0,
@@ -176,18 +374,27 @@ ShaderModule::Impl::Impl(imr::Device& device, imr::SPIRVModule&& spirv_module) n
 
 VkShaderModule ShaderModule::vk_shader_module() const { return _impl->vk_shader_module; }
 
+std::vector<uint32_t> ShaderModule::specialization_ids() const {
+    std::vector<uint32_t> ids;
+    for (auto& [id, size] : _impl->specialization_sizes)
+        ids.push_back(id);
+    return ids;
+}
+
 ShaderModule::Impl::~Impl() {
     vkDestroyShaderModule(device.device, vk_shader_module, nullptr);
 }
 
 ShaderModule::~ShaderModule() = default;
 
-ShaderEntryPoint::ShaderEntryPoint(imr::ShaderModule& module, VkShaderStageFlagBits stage, const std::string& entrypoint_name) {
-    _impl = std::make_unique<Impl>(module, stage, entrypoint_name);
+ShaderEntryPoint::ShaderEntryPoint(imr::ShaderModule& module, VkShaderStageFlagBits stage, const std::string& entrypoint_name, SpecializationConstants specialization) {
+    _impl = std::make_unique<Impl>(module, stage, entrypoint_name, std::move(specialization));
 }
 
-ShaderEntryPoint::Impl::Impl(imr::ShaderModule& module, VkShaderStageFlagBits stage, const std::string& name) : module(module), stage(stage), name(name) {
-    reflected = std::make_unique<ReflectedLayout>(module._impl->spirv_module, stage);
+ShaderEntryPoint::Impl::Impl(imr::ShaderModule& module, VkShaderStageFlagBits stage, const std::string& name, SpecializationConstants&& specialization) : module(module), stage(stage), name(name), specialization(std::move(specialization)) {
+    // catches typos in the constant ids early, rather than when building a pipeline
+    PackedSpecialization check(module, this->specialization);
+    reflected = std::make_unique<ReflectedLayout>(get_reflected_layout(module._impl->spirv_module, module._impl->spirv_hash, stage, name));
 }
 
 const std::string& ShaderEntryPoint::name() const { return _impl->name; }
@@ -196,45 +403,67 @@ const ShaderModule& ShaderEntryPoint::module() const { return _impl->module; }
 
 VkShaderStageFlagBits ShaderEntryPoint::stage() const { return _impl->stage; }
 
+const SpecializationConstants& ShaderEntryPoint::specialization() const { return _impl->specialization; }
+
 ShaderEntryPoint::Impl::~Impl() = default;
 
 ShaderEntryPoint::~ShaderEntryPoint() = default;
 
-ComputePipeline::Impl::Impl(imr::Device& device, imr::ShaderEntryPoint& entry_point) : device(device) {
-    layout = std::make_unique<PipelineLayout>(device, *entry_point._impl->reflected);
+ComputePipeline::Impl::Impl(imr::Device& device, imr::ShaderEntryPoint& entry_point, const PipelineOptions& options) : device(device), shader(entry_point) {
+    layout = std::make_unique<PipelineLayout>(device, *entry_point._impl->reflected, VK_PIPELINE_BIND_POINT_COMPUTE, options);
+    pipeline = create_pipeline(entry_point.specialization());
+}
 
-    pipeline = VK_NULL_HANDLE;
-    CHECK_VK_THROW(vkCreateComputePipelines(device.device, VK_NULL_HANDLE, 1, tmpPtr((VkComputePipelineCreateInfo) {
+VkPipeline ComputePipeline::Impl::create_pipeline(const SpecializationConstants& specialization) {
+    PackedSpecialization packed(shader.module(), specialization);
+    VkPipeline created = VK_NULL_HANDLE;
+    Tracer::Span span(device, "create compute pipeline");
+    CHECK_VK_THROW(vkCreateComputePipelines(device.device, device.pipeline_cache, 1, tmpPtr((VkComputePipelineCreateInfo) {
             .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
-            .flags = 0,
+            .flags = layout->descriptor_buffer ? VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT : 0u,
             .stage = {
                     .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
                     .flags = 0,
-                    .stage = entry_point.stage(),
-                    .module = entry_point._impl->module.vk_shader_module(),
-                    .pName = entry_point.name().c_str(),
+                    .stage = shader.stage(),
+                    .module = shader.module().vk_shader_module(),
+                    .pName = shader.name().c_str(),
+                    .pSpecializationInfo = packed.get(),
             },
             .layout = layout->pipeline_layout,
-    }), nullptr, &pipeline));
+    }), nullptr, &created));
+    return created;
 }
 
-ComputePipeline::Impl::Impl(imr::Device& device, std::unique_ptr<ShaderModule>&& module, std::unique_ptr<ShaderEntryPoint>&& ep) : Impl(device, *ep) {
+ComputePipeline::Impl::Impl(imr::Device& device, std::unique_ptr<ShaderModule>&& module, std::unique_ptr<ShaderEntryPoint>&& ep, const PipelineOptions& options) : Impl(device, *ep, options) {
     this->module = std::move(module);
     this->entry_point = std::move(ep);
     assert(this->module && this->entry_point);
 }
 
-ComputePipeline::ComputePipeline(imr::Device& device, std::string&& spirv_filename, std::string&& entrypoint_name) {
+ComputePipeline::ComputePipeline(imr::Device& device, std::string&& spirv_filename, std::string&& entrypoint_name, SpecializationConstants specialization, PipelineOptions options) {
     auto shader_module = std::make_unique<ShaderModule>(device, std::move(spirv_filename));
-    auto entry_point = std::make_unique<ShaderEntryPoint>(*shader_module, VK_SHADER_STAGE_COMPUTE_BIT, entrypoint_name);
-    _impl = std::make_unique<ComputePipeline::Impl>(device, std::move(shader_module), std::move(entry_point));
+    auto entry_point = std::make_unique<ShaderEntryPoint>(*shader_module, VK_SHADER_STAGE_COMPUTE_BIT, entrypoint_name, std::move(specialization));
+    _impl = std::make_unique<ComputePipeline::Impl>(device, std::move(shader_module), std::move(entry_point), options);
 }
 
 ComputePipeline::Impl::~Impl() {
+    for (auto& [specialization, variant] : variants)
+        vkDestroyPipeline(device.device, variant, nullptr);
     vkDestroyPipeline(device.device, pipeline, nullptr);
 }
 
 VkPipeline ComputePipeline::pipeline() const { return _impl->pipeline; }
+
+VkPipeline ComputePipeline::pipeline(const SpecializationConstants& specialization) {
+    if (specialization == _impl->shader.specialization())
+        return _impl->pipeline;
+    std::lock_guard lock(_impl->variants_mutex);
+    auto& variant = _impl->variants[specialization];
+    if (!variant)
+        variant = _impl->create_pipeline(specialization);
+    return variant;
+}
+
 VkPipelineLayout ComputePipeline::layout() const { return _impl->layout->pipeline_layout; }
 VkDescriptorSetLayout ComputePipeline::set_layout(unsigned i) const { return _impl->layout->set_layouts[i]; }
 
@@ -19,20 +19,58 @@ struct ReflectedLayout {
     ReflectedLayout(ReflectedLayout& a, ReflectedLayout& b);
 };
 
+uint64_t hash_spirv_module(const SPIRVModule& module);
+
+/// Finds the specialization constants declared in the module, and the size of their values, by constant_id
+std::map<uint32_t, uint32_t> reflect_specialization_constants(const SPIRVModule& module);
+
+/// Reflecting goes through a whole shady IR arena, so the results are cached by SPIR-V contents, stage and entry point.
+/// The cache lives as long as the process, and on disk too if IMR_REFLECTION_CACHE names a directory to keep it in.
+ReflectedLayout get_reflected_layout(SPIRVModule& spirv_module, uint64_t spirv_hash, VkShaderStageFlagBits stage, const std::string& entry_point);
+
+/// Room for any one descriptor's info in the data read by update templates
+union DescriptorTemplateSlot {
+    VkDescriptorImageInfo image;
+    VkDescriptorBufferInfo buffer;
+    VkBufferView texel_buffer;
+};
+
 /// Turns the ReflectedLayout into the VkDescriptorSetLayout s and VkPipelineLayout
 struct PipelineLayout {
     imr::Device& device;
 
     std::vector<VkDescriptorSetLayout> set_layouts;
+    /// How many descriptors of each type a set holds, for DescriptorAllocator
+    std::vector<std::vector<VkDescriptorPoolSize>> set_pool_sizes;
     VkPipelineLayout pipeline_layout;
-
-    PipelineLayout(imr::Device& device, ReflectedLayout& reflected_layout);
+    /// The set whose descriptors are pushed into the command buffer rather than allocated, if any
+    std::optional<uint32_t> push_set;
+    /// What BindlessHeap::set is, if it's the bindless heap
+    BindlessHeap* bindless = nullptr;
+    /// Whether the set layouts are for descriptor buffers, see Device::use_descriptor_buffers.
+    /// Then each set gets set_offsets[set] into a range of descriptor_buffer_size bytes.
+    bool descriptor_buffer = false;
+    std::vector<VkDeviceSize> set_offsets;
+    VkDeviceSize descriptor_buffer_size = 0;
+
+    /// Writes a whole set with one call. Only built for the sets where each binding holds a single descriptor,
+    /// whose data is then one descriptor info per binding, at binding_offsets.
+    struct SetUpdateTemplate {
+        VkDescriptorUpdateTemplate handle = VK_NULL_HANDLE;
+        std::map<uint32_t, size_t> binding_offsets;
+        size_t data_size = 0;
+    };
+    std::vector<SetUpdateTemplate> update_templates;
+
+    PipelineLayout(imr::Device& device, ReflectedLayout& reflected_layout, VkPipelineBindPoint bind_point, const PipelineOptions& options);
     ~PipelineLayout();
 };
 
 struct ShaderModule::Impl {
     imr::Device& device;
     SPIRVModule spirv_module;
+    uint64_t spirv_hash;
+    std::map<uint32_t, uint32_t> specialization_sizes;
     VkShaderModule vk_shader_module;
 
     Impl(imr::Device& device, SPIRVModule&& spirv_module) noexcept(false);
@@ -43,31 +81,51 @@ struct ShaderModule::Impl {
     ~Impl();
 };
 
+/// Lays out specialization constants the way VkSpecializationInfo wants them, after checking them against the module
+struct PackedSpecialization {
+    std::vector<VkSpecializationMapEntry> entries;
+    std::vector<std::byte> data;
+    VkSpecializationInfo info;
+
+    PackedSpecialization(const ShaderModule& module, const SpecializationConstants& constants) noexcept(false);
+    PackedSpecialization(const PackedSpecialization&) = delete;
+
+    /// nullptr when there is nothing to specialize
+    const VkSpecializationInfo* get() const;
+};
+
 struct ShaderEntryPoint::Impl {
     ShaderModule& module;
     VkShaderStageFlagBits stage;
     std::string name;
+    SpecializationConstants specialization;
     std::unique_ptr<ReflectedLayout> reflected;
 
-    Impl(ShaderModule& module, VkShaderStageFlagBits stage, const std::string& entrypoint_name);
+    Impl(ShaderModule& module, VkShaderStageFlagBits stage, const std::string& entrypoint_name, SpecializationConstants&& specialization);
     ~Impl();
 };
 
 struct ComputePipeline::Impl {
     Device& device;
+    ShaderEntryPoint& shader;
     std::unique_ptr<PipelineLayout> layout;
     VkPipeline pipeline;
 
+    /// Built by pipeline(const SpecializationConstants&), the compile threads might ask for them too
+    std::mutex variants_mutex;
+    std::map<SpecializationConstants, VkPipeline> variants;
+    VkPipeline create_pipeline(const SpecializationConstants&);
+
     std::unique_ptr<ShaderModule> module;
     std::unique_ptr<ShaderEntryPoint> entry_point;
 
-    Impl(imr::Device& device, std::unique_ptr<ShaderModule>&& module, std::unique_ptr<ShaderEntryPoint>&& ep);
-    Impl(imr::Device& device, ShaderEntryPoint& entry_point);
+    Impl(imr::Device& device, std::unique_ptr<ShaderModule>&& module, std::unique_ptr<ShaderEntryPoint>&& ep, const PipelineOptions& options);
+    Impl(imr::Device& device, ShaderEntryPoint& entry_point, const PipelineOptions& options);
     ~Impl();
 };
 
 struct GraphicsPipeline::Impl {
-    Impl(Device& device, std::vector<ShaderEntryPoint*>&& stages, RenderTargetsState, StateBuilder);
+    Impl(Device& device, std::vector<ShaderEntryPoint*>&& stages, RenderTargetsState, StateBuilder, const PipelineOptions& options);
 
     ~Impl();
 
@@ -0,0 +1,96 @@
+#include "imr_private.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace imr {
+
+static const size_t staging_ring_capacity = 16 * 1024 * 1024;
+static const size_t staging_alignment = 16;
+
+StagingRing::StagingRing(Device& device, size_t capacity) : device(device), capacity(capacity) {
+    buffer = std::make_unique<Buffer>(device, capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    mapped = buffer->mapped().data();
+}
+
+StagingRing::~StagingRing() {
+    staged.clear();
+    buffer.reset();
+}
+
+std::optional<size_t> StagingRing::allocate(size_t size) {
+    uint64_t start = (head + staging_alignment - 1) & ~(uint64_t) (staging_alignment - 1);
+    size_t position = start % capacity;
+    // allocations don't wrap around, skip to the start of the buffer instead
+    if (position + size > capacity) {
+        start += capacity - position;
+        position = 0;
+    }
+    if (start + size - tail > capacity)
+        return std::nullopt;
+    head = start + size;
+    return position;
+}
+
+std::tuple<VkBuffer, size_t> StagingRing::stage(size_t size, const void* data) {
+    reclaim();
+    if (auto position = allocate(size)) {
+        memcpy(mapped + *position, data, size);
+        staged.push_back({ .end = head });
+        return { buffer->handle, *position };
+    }
+
+    auto staging = std::make_unique<Buffer>(device, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+    staging->uploadDataSync(0, size, const_cast<void*>(data));
+    VkBuffer handle = staging->handle;
+    staged.push_back({ .end = head, .overflow = std::move(staging) });
+    return { handle, 0 };
+}
+
+StagingRing::Mark StagingRing::mark() const {
+    return released + staged.size();
+}
+
+void StagingRing::retire(Mark begin, Mark end, uint64_t timeline_value) {
+    for (Mark i = std::max(begin, released); i < end; i++) {
+        auto& upload = staged[i - released];
+        if (!upload.timeline_value)
+            upload.timeline_value = timeline_value;
+    }
+}
+
+void StagingRing::release(Mark mark) {
+    for (Mark i = released; i < mark; i++)
+        staged[i - released].timeline_value = 0;
+    reclaim();
+}
+
+void StagingRing::reclaim() {
+    // only asked for when there's something it decides
+    std::optional<uint64_t> completed;
+    while (!staged.empty() && staged.front().timeline_value) {
+        uint64_t value = *staged.front().timeline_value;
+        if (value > 0) {
+            if (!completed)
+                completed = device.completedTimelineValue();
+            if (value > *completed)
+                break;
+        }
+        tail = std::max(tail, staged.front().end);
+        staged.pop_front();
+        released++;
+    }
+}
+
+void Device::retireStagedUploads(uint64_t value) {
+    if (_impl->staging)
+        _impl->staging->retire(0, _impl->staging->mark(), value);
+}
+
+StagingRing& Device::Impl::staging_ring(Device& device) {
+    if (!staging)
+        staging = std::make_unique<StagingRing>(device, staging_ring_capacity);
+    return *staging;
+}
+
+}
@@ -33,7 +33,7 @@ SwapchainSlot::SwapchainSlot(Swapchain& s) : swapchain(s) {
     vk.setDebugUtilsObjectNameEXT(tmpPtr((VkDebugUtilsObjectNameInfoEXT) {
         .sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT,
         .objectType = VK_OBJECT_TYPE_SEMAPHORE,
-        .objectHandle = reinterpret_cast<uint64_t>(copy_done),
+        .objectHandle = reinterpret_cast<uint64_t>(present_semaphore),
         .pObjectName = "SwapchainSlot::present_queued"
     }));
 }
@@ -42,13 +42,68 @@ SwapchainSlot::~SwapchainSlot() {
     auto& device = swapchain._impl->device;
     if (wait_for_previous_present) {
         CHECK_VK_THROW(vkWaitForFences(device.device, 1, &wait_for_previous_present, true, UINT64_MAX));
-        vkDestroyFence(device.device, wait_for_previous_present, nullptr);
+        device.recycleFence(wait_for_previous_present);
         wait_for_previous_present = nullptr;
     }
     vkDestroySemaphore(device.device, copy_done, nullptr);
     vkDestroySemaphore(device.device, present_semaphore, nullptr);
-    if (wait_for_previous_present)
-        vkDestroyFence(device.device, wait_for_previous_present, nullptr);
+}
+
+static void create_command_pool(Device& device, RecycledCommandPool& pool, uint32_t queue_family) {
+    CHECK_VK_THROW(vkCreateCommandPool(device.device, tmpPtr((VkCommandPoolCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = queue_family,
+    }), nullptr, &pool.pool));
+}
+
+FrameInFlight::FrameInFlight(Swapchain& s) : swapchain(s) {
+    auto& device = s._impl->device;
+
+    create_command_pool(device, command_pool, device.main_queue_idx);
+    create_command_pool(device, compute_command_pool, device.compute_queue_idx);
+}
+
+VkCommandBuffer FrameInFlight::get_command_buffer(RecycledCommandPool& pool) {
+    if (pool.used == pool.command_buffers.size()) {
+        auto& device = swapchain._impl->device;
+        VkCommandBuffer cmdbuf;
+        CHECK_VK_THROW(vkAllocateCommandBuffers(device.device, tmpPtr((VkCommandBufferAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = pool.pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        }), &cmdbuf));
+        pool.command_buffers.push_back(cmdbuf);
+    }
+    return pool.command_buffers[pool.used++];
+}
+
+void FrameInFlight::recycle() {
+    auto& device = swapchain._impl->device;
+    // The previous frame has to be done executing before we can recycle its command buffers.
+    // Its last submission waited on any async compute work, so that's done too.
+    if (frame) {
+        Tracer::Span span(device, "wait for frame in flight");
+        device.waitForTimelineValue(frame->_impl->timeline_value);
+        frame.reset();
+    }
+    if (transient_images)
+        transient_images->evict_unused();
+    for (auto pool : { &command_pool, &compute_command_pool }) {
+        CHECK_VK_THROW(vkResetCommandPool(device.device, pool->pool, 0));
+        pool->used = 0;
+    }
+}
+
+FrameInFlight::~FrameInFlight() {
+    auto& device = swapchain._impl->device;
+    // the frame might still be using command buffers from our pool
+    frame.reset();
+    readback_buffer.reset();
+    transient_images.reset();
+    vkDestroyCommandPool(device.device, command_pool.pool, nullptr);
+    vkDestroyCommandPool(device.device, compute_command_pool.pool, nullptr);
 }
 
 Swapchain::Swapchain(Device& device, GLFWwindow* window) {
@@ -62,6 +117,20 @@ Swapchain::Impl::Impl(Swapchain& parent, Device& device, GLFWwindow* window) : p
     CHECK_VK_THROW(glfwCreateWindowSurface(device.context.instance, window, nullptr, &surface));
 }
 
+Swapchain::Swapchain(Device& device, VkExtent2D size) {
+    if (!device.context.headless_surface_supported)
+        throw std::runtime_error("headless swapchains need VK_EXT_headless_surface");
+
+    _impl = std::make_unique<Swapchain::Impl>(*this, device, size);
+    _impl->build_swapchain();
+}
+
+Swapchain::Impl::Impl(Swapchain& parent, Device& device, VkExtent2D headless_size) : parent(parent), device(device), headless_size(headless_size) {
+    CHECK_VK_THROW(device.context.dispatch.createHeadlessSurfaceEXT(tmpPtr((VkHeadlessSurfaceCreateInfoEXT) {
+        .sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT,
+    }), nullptr, &surface));
+}
+
 void Swapchain::Impl::build_swapchain() {
     uint32_t surface_formats_count;
     CHECK_VK_THROW(vkGetPhysicalDeviceSurfaceFormatsKHR(device.physical_device, surface, &surface_formats_count, nullptr));
@@ -85,10 +154,21 @@ void Swapchain::Impl::build_swapchain() {
     }
 
     int width, height;
-    glfwGetFramebufferSize(window, &width, &height);
+    if (headless_size) {
+        width = static_cast<int>(headless_size->width);
+        height = static_cast<int>(headless_size->height);
+    } else
+        glfwGetFramebufferSize(window, &width, &height);
+
+    VkSurfaceCapabilitiesKHR surface_caps;
+    CHECK_VK_THROW(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device.physical_device, surface, &surface_caps));
 
     auto builder = vkb::SwapchainBuilder(device.physical_device, device.device, surface);
     builder.add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT);
+    // needed to read frames back, most surfaces support it
+    can_read_back = surface_caps.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    if (can_read_back)
+        builder.add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
     builder.set_desired_extent(width, height);
     builder.set_desired_present_mode(VK_PRESENT_MODE_MAILBOX_KHR);
     builder.add_fallback_present_mode(VK_PRESENT_MODE_IMMEDIATE_KHR);
@@ -97,21 +177,38 @@ void Swapchain::Impl::build_swapchain() {
 
     if (auto built = builder.build(); built.has_value()) {
         swapchain = built.value();
+        // present ids are per-swapchain
+        present_id = 0;
     } else {
         fprintf(stderr, "Failed to build a swapchain (size=%d,%d, error=%d).\n", width, height, built.vk_result());
         throw std::runtime_error("failure to build a swapchain");
     }
 
+    auto images = swapchain.get_images().value();
+    VkExtent3D size = { swapchain.extent.width, swapchain.extent.height, 1 };
     for (int i = 0; i < swapchain.image_count; i++) {
-        slots.emplace_back(std::make_unique<SwapchainSlot>(parent));
+        auto& slot = slots.emplace_back(std::make_unique<SwapchainSlot>(parent));
+        slot->image = images[i];
+        slot->image_index = i;
+        slot->wrapped_image = std::make_unique<Image>(make_image_from(device, images[i], VK_IMAGE_TYPE_2D, size, swapchain.image_format, swapchain.image_usage_flags));
     }
 }
 
 void Swapchain::Impl::destroy_swapchain() {
+    // frames reference the slots, so they have to go first
+    for (auto& in_flight : frames_in_flight)
+        in_flight->frame.reset();
     slots.clear();
     vkb::destroy_swapchain(swapchain);
 }
 
+void Swapchain::Impl::build_frames_in_flight() {
+    frames_in_flight.clear();
+    for (int i = 0; i < std::max(parent.maxFramesInFlight, 1); i++) {
+        frames_in_flight.emplace_back(std::make_unique<FrameInFlight>(parent));
+    }
+}
+
 Swapchain::Impl::~Impl() {
     vkDestroySurfaceKHR(device.context.dispatch.instance, surface, nullptr);
 }
@@ -129,10 +226,7 @@ std::optional<std::tuple<SwapchainSlot&, VkSemaphore>> nextSwapchainSlot(Swapcha
 
     uint32_t image_index;
 
-    VkSemaphore image_acquired_semaphore;
-    CHECK_VK_THROW(vkCreateSemaphore(device.device, tmpPtr((VkSemaphoreCreateInfo) {
-        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-    }), nullptr, &image_acquired_semaphore));
+    VkSemaphore image_acquired_semaphore = device.getSemaphore();
 
     vk.setDebugUtilsObjectNameEXT(tmpPtr((VkDebugUtilsObjectNameInfoEXT) {
         .sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT,
@@ -141,19 +235,19 @@ std::optional<std::tuple<SwapchainSlot&, VkSemaphore>> nextSwapchainSlot(Swapcha
         .pObjectName = "SwapchainSlot::image_acquired"
     }));
 
-    VkFence fence;
-    CHECK_VK_THROW(vkCreateFence(device.device, tmpPtr((VkFenceCreateInfo) {
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-    }), nullptr, &fence));
+    VkFence fence = device.getFence();
 
+    Tracer::Span acquire_span(device, "acquire");
     VkResult acquire_result = device.dispatch.acquireNextImageKHR(_impl->swapchain, UINT64_MAX, image_acquired_semaphore, fence, &image_index);
+    acquire_span.end();
     switch (acquire_result) {
         case VK_SUCCESS: break;
         case VK_SUBOPTIMAL_KHR: _impl->should_resize = true; break;
         case VK_ERROR_OUT_OF_DATE_KHR: {
             fprintf(stderr, "Acquire failed. We need to resize!\n");
-            vkDestroySemaphore(device.device, image_acquired_semaphore, nullptr);
-            vkDestroyFence(device.device, fence, nullptr);
+            // neither of these got signalled, so they can go straight back to the pool
+            device.recycleSemaphore(image_acquired_semaphore);
+            device.recycleFence(fence);
             return std::nullopt;
         }
         default:
@@ -164,8 +258,6 @@ std::optional<std::tuple<SwapchainSlot&, VkSemaphore>> nextSwapchainSlot(Swapcha
     // We know the next image !
     SwapchainSlot& slot = *_impl->slots[image_index];
     //printf("Image acquired: %d\n", image_index);
-    slot.image = _impl->swapchain.get_images().value()[image_index];
-    slot.image_index = image_index;
 
     VkFence prev_fence = slot.wait_for_previous_present;
     slot.wait_for_previous_present = fence;
@@ -174,13 +266,12 @@ std::optional<std::tuple<SwapchainSlot&, VkSemaphore>> nextSwapchainSlot(Swapcha
     // First make sure the _previous_ present is finished.
     // We could also set and wait on an acquire fence, but the validation layers are apparently not convinced this is sufficiently safe...
     if (prev_fence) {
+        Tracer::Span span(device, "wait for previous present");
         CHECK_VK_THROW(vkWaitForFences(device.device, 1, &prev_fence, true, UINT64_MAX));
-        vkDestroyFence(device.device, prev_fence, nullptr);
+        device.recycleFence(prev_fence);
     }
     //printf("Waited for %llx\n", (uint64_t) slot.wait_for_previous_present);
 
-    slot.frame.reset();
-
     return std::tie<SwapchainSlot&, VkSemaphore>(slot, image_acquired_semaphore);
 }
 
@@ -192,9 +283,9 @@ void Swapchain::drain() {
     auto& device = _impl->device;
     vkDeviceWaitIdle(device.device);
 
-    for (auto& slot : _impl->slots) {
-        if (slot->frame && slot->frame->_impl->submitted)
-            slot->frame.reset();
+    for (auto& in_flight : _impl->frames_in_flight) {
+        if (in_flight->frame && in_flight->frame->_impl->submitted)
+            in_flight->frame.reset();
     }
     //_impl->prev_frames.clear();
 }
@@ -203,6 +294,7 @@ Swapchain::~Swapchain() {
     drain();
 
     _impl->destroy_swapchain();
+    _impl->frames_in_flight.clear();
     _impl.reset();
 }
 
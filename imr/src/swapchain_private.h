@@ -6,25 +6,52 @@
 namespace imr {
 
 struct SwapchainSlot;
+struct FrameInFlight;
+
+/// Holds back presentation to hit a target frame rate.
+/// Sleeping is only precise to a millisecond or so, therefore we sleep for the bulk of the wait and spin for the rest.
+struct FramePacer {
+    uint64_t deadline = 0;
+    uint64_t last_release = 0;
+
+    // exponential moving averages, in nanoseconds
+    double target_interval = 0;
+    double average_interval = 0;
+    double interval_variance = 0;
+    double average_error = 0;
+
+    void pace(int max_fps);
+    Swapchain::PacingStats stats() const;
+};
 
 struct Swapchain::Impl {
     Swapchain& parent;
     Device& device;
     GLFWwindow* window = nullptr;
+    /// Set for headless swapchains, which have no window to get a size from
+    std::optional<VkExtent2D> headless_size;
     Impl(Swapchain& parent, Device&, GLFWwindow*);
+    Impl(Swapchain& parent, Device&, VkExtent2D headless_size);
     ~Impl();
 
     VkSurfaceKHR surface;
     size_t frame_counter = 0;
 
-    uint64_t last_present = 0;
+    FramePacer pacer;
+    /// Last VK_KHR_present_id value we presented with, 0 if none
+    uint64_t present_id = 0;
     bool should_resize = false;
+    /// Whether the swapchain images can be copied from, which onFrameReadback needs
+    bool can_read_back = false;
 
     vkb::Swapchain swapchain;
     std::vector<std::unique_ptr<SwapchainSlot>> slots;
+    /// Ring of per-frame resources, sized after maxFramesInFlight rather than after the swapchain image count
+    std::vector<std::unique_ptr<FrameInFlight>> frames_in_flight;
 
     void build_swapchain();
     void destroy_swapchain();
+    void build_frames_in_flight();
 };
 
 struct SwapchainSlot {
@@ -34,29 +61,126 @@ struct SwapchainSlot {
 
     VkImage image;
     uint32_t image_index;
+    /// Wraps the swapchain image for the whole life of the swapchain, so its views are only ever created once
+    std::unique_ptr<Image> wrapped_image;
 
     VkSemaphore copy_done;
     VkSemaphore present_semaphore;
     VkFence wait_for_previous_present = VK_NULL_HANDLE;
 
+    ~SwapchainSlot();
+};
+
+/// Transient pool and the command buffers allocated from it so far, which are handed out again after each reset
+struct RecycledCommandPool {
+    VkCommandPool pool;
+    std::vector<VkCommandBuffer> command_buffers;
+    size_t used = 0;
+};
+
+/// Backs the transient images of the RenderGraph for one FrameInFlight, so it's only reused once the frame that used it retired.
+/// Images that don't live at the same time share a memory slot, the slots and images are kept around for the next frames.
+struct TransientImagePool {
+    Device& device;
+    TransientImagePool(Device& device) : device(device) {}
+    TransientImagePool(TransientImagePool&) = delete;
+    ~TransientImagePool();
+
+    struct Slot {
+        VmaAllocation allocation = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        uint32_t memory_type = 0;
+        /// Where the allocation starts in its VkDeviceMemory, for checking the alignment
+        VkDeviceSize offset = 0;
+    };
+    std::vector<Slot> slots;
+
+    using ImageKey = std::tuple<VkImageType, uint32_t, uint32_t, uint32_t, VkFormat, VkImageUsageFlags>;
+    struct PooledImage {
+        VkImage handle;
+        std::unique_ptr<Image> image;
+        /// The generation that last used it
+        uint64_t last_used = 0;
+    };
+    /// Bound to the memory of a slot, by slot index
+    std::map<std::tuple<ImageKey, size_t>, PooledImage> images;
+
+    struct CachedRequirements {
+        VkMemoryRequirements requirements;
+        uint64_t last_used;
+    };
+    std::map<ImageKey, CachedRequirements> requirements_cache;
+    VkMemoryRequirements requirements(const ImageKey&);
+
+    /// Bumped by evict_unused(), once per frame that uses the pool
+    uint64_t generation = 0;
+    /// How many slots this generation asked for
+    size_t slots_used = 0;
+
+    /// Makes sure the slot's memory fits, the images bound to it go away if it has to be reallocated
+    void ensure_slot(size_t slot, VkMemoryRequirements);
+    Image& get_image(const ImageKey&, size_t slot);
+    void destroy_image(PooledImage&);
+    /// Drops the images, slots and cached requirements the last frame didn't use, otherwise every size the window was ever resized to sticks around.
+    /// That frame has to have retired.
+    void evict_unused();
+};
+
+/// Per-frame resources, recycled once the frame that last used them has retired
+struct FrameInFlight {
+    Swapchain& swapchain;
+    FrameInFlight(Swapchain& s);
+    FrameInFlight(FrameInFlight&) = delete;
+
+    /// Pools the frame records into, reset as a whole when this is recycled
+    RecycledCommandPool command_pool;
+    /// For Device::compute_queue_idx
+    RecycledCommandPool compute_command_pool;
+
+    /// Host-visible copy of the frame, for Swapchain::onFrameReadback. Only allocated once that is used.
+    std::unique_ptr<Buffer> readback_buffer;
+    /// For RenderGraph, only created once that is used
+    std::unique_ptr<TransientImagePool> transient_images;
+
+    /// Hands out a command buffer from one of our pools, reusing the ones allocated by previous frames
+    VkCommandBuffer get_command_buffer(RecycledCommandPool&);
+    /// Waits for the previous frame to retire, runs its cleanup and resets the command pool
+    void recycle();
+
     std::unique_ptr<Swapchain::Frame> frame = nullptr;
 
-    ~SwapchainSlot();
+    ~FrameInFlight();
 };
 
 struct Swapchain::Frame::Impl {
     Device& device;
     SwapchainSlot& slot;
-    std::unique_ptr<Image> image;
+    FrameInFlight& in_flight;
+    /// The slot's image
+    Image* image;
     bool submitted = false;
+    /// Value of Device::timeline signalled by the last submission for this frame, 0 when nothing was submitted
+    uint64_t timeline_value = 0;
 
     Impl(Impl&) = delete;
     Impl(Impl&&) = default;
     Impl& operator=(Impl&&) = default;
-    Impl(Device&, SwapchainSlot&);
+    Impl(Device&, SwapchainSlot&, FrameInFlight&);
 
     std::vector<VkFence> cleanup_fences;
     std::vector<std::function<void(void)>> cleanup_queue;
+
+    struct Wait {
+        VkSemaphore semaphore;
+        uint64_t value;
+        VkPipelineStageFlags stages;
+    };
+    std::vector<Wait> waits;
+    /// Queue family ownership acquires for images coming back from submitAsyncCompute
+    std::vector<VkImageMemoryBarrier2> image_acquires;
+    /// Hands the waits added since the last submission to the next one: they're appended to its waits, and values is filled in for all of them.
+    /// Pending ownership acquires get recorded into a command buffer put in front of the others.
+    void append_waits(std::vector<VkSemaphore>& semaphores, std::vector<VkPipelineStageFlags>& stages, std::vector<uint64_t>& values, std::vector<VkCommandBuffer>& command_buffers);
 };
 
 std::optional<std::tuple<SwapchainSlot&, VkSemaphore>> nextSwapchainSlot(Swapchain::Impl* _impl);
@@ -0,0 +1,91 @@
+#include "imr_private.h"
+
+namespace imr {
+
+VkFence Device::getFence() {
+    if (!_impl->free_fences.empty()) {
+        VkFence fence = _impl->free_fences.back();
+        _impl->free_fences.pop_back();
+        return fence;
+    }
+
+    VkFence fence;
+    CHECK_VK_THROW(vkCreateFence(device.device, tmpPtr((VkFenceCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        .flags = 0,
+    }), nullptr, &fence));
+    return fence;
+}
+
+void Device::recycleFence(VkFence fence) {
+    CHECK_VK_THROW(vkResetFences(device.device, 1, &fence));
+    _impl->free_fences.push_back(fence);
+}
+
+VkSemaphore Device::getSemaphore() {
+    if (!_impl->free_semaphores.empty()) {
+        VkSemaphore semaphore = _impl->free_semaphores.back();
+        _impl->free_semaphores.pop_back();
+        return semaphore;
+    }
+
+    VkSemaphore semaphore;
+    CHECK_VK_THROW(vkCreateSemaphore(device.device, tmpPtr((VkSemaphoreCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+    }), nullptr, &semaphore));
+    return semaphore;
+}
+
+void Device::recycleSemaphore(VkSemaphore semaphore) {
+    _impl->free_semaphores.push_back(semaphore);
+}
+
+uint64_t Device::nextTimelineValue() {
+    return ++_impl->last_timeline_value;
+}
+
+uint64_t Device::completedTimelineValue() {
+    uint64_t value;
+    CHECK_VK_THROW(vkGetSemaphoreCounterValue(device.device, timeline, &value));
+    return value;
+}
+
+void Device::waitForTimelineValue(uint64_t value) {
+    CHECK_VK_THROW(vkWaitSemaphores(device.device, tmpPtr((VkSemaphoreWaitInfo) {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &timeline,
+        .pValues = &value,
+    }), UINT64_MAX));
+}
+
+void Device::deferCleanup(uint64_t value, std::function<void(void)>&& fn) {
+    _impl->deferred_cleanup.emplace_back(value, std::move(fn));
+}
+
+void Device::collectGarbage() {
+    if (_impl->deferred_cleanup.empty())
+        return;
+    uint64_t completed = completedTimelineValue();
+
+    // cleanup jobs are allowed to defer more cleanup, so we take the queue out first
+    auto pending = std::move(_impl->deferred_cleanup);
+    _impl->deferred_cleanup.clear();
+    for (auto& [value, fn] : pending) {
+        if (value <= completed)
+            fn();
+        else
+            _impl->deferred_cleanup.emplace_back(value, std::move(fn));
+    }
+}
+
+void Device::Impl::destroy_sync_pools(Device& device) {
+    for (auto fence : free_fences)
+        vkDestroyFence(device.device, fence, nullptr);
+    free_fences.clear();
+    for (auto semaphore : free_semaphores)
+        vkDestroySemaphore(device.device, semaphore, nullptr);
+    free_semaphores.clear();
+}
+
+}
@@ -0,0 +1,154 @@
+#include "imr_private.h"
+#include "imr/util.h"
+
+#include <algorithm>
+#include <cinttypes>
+
+namespace imr {
+
+static std::atomic<uint64_t> next_tracer_id = 1;
+
+/// The buffer of the tracer this thread last recorded to, so finding it is cheap
+static thread_local struct {
+    uint64_t tracer = 0;
+    Tracer::Impl::ThreadBuffer* buffer = nullptr;
+} this_thread;
+
+Tracer::Impl::Impl(Device& device, size_t max_events) : device(device), id(next_tracer_id++), start(imr_get_time_nano()), max_events(std::max<size_t>(max_events, 1)) {
+#ifdef __linux__
+    // the GPU clock has to be comparable with imr_get_time_nano(), which uses CLOCK_MONOTONIC there
+    auto get_time_domains = device.context.dispatch.fp_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT;
+    if (device._impl->calibrated_timestamps_supported && get_time_domains) {
+        uint32_t count = 0;
+        get_time_domains(device.physical_device, &count, nullptr);
+        std::vector<VkTimeDomainEXT> domains(count);
+        get_time_domains(device.physical_device, &count, domains.data());
+        auto has = [&](VkTimeDomainEXT domain) { return std::find(domains.begin(), domains.end(), domain) != domains.end(); };
+        calibrated = has(VK_TIME_DOMAIN_DEVICE_EXT) && has(VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT);
+    }
+#endif
+}
+
+Tracer::Impl::ThreadBuffer& Tracer::Impl::thread_buffer() {
+    if (this_thread.tracer == id)
+        return *this_thread.buffer;
+
+    std::unique_lock lock(mutex);
+    auto thread = std::this_thread::get_id();
+    auto found = std::find_if(threads.begin(), threads.end(), [&](auto& buffer) { return buffer->thread == thread; });
+    if (found == threads.end()) {
+        auto& buffer = threads.emplace_back(std::make_unique<ThreadBuffer>());
+        buffer->thread = thread;
+        // tid 0 is the GPU
+        buffer->tid = static_cast<uint32_t>(threads.size());
+        found = threads.end() - 1;
+    }
+    this_thread = { id, found->get() };
+    return **found;
+}
+
+void Tracer::Impl::EventRing::push(const Event& event, size_t max_events) {
+    if (events.size() < max_events) {
+        events.push_back(event);
+        return;
+    }
+    events[next] = event;
+    next = (next + 1) % events.size();
+    dropped++;
+}
+
+void Tracer::Impl::record(const char* name, uint64_t begin, uint64_t end) {
+    auto& buffer = thread_buffer();
+    std::unique_lock lock(buffer.mutex);
+    buffer.events.push({ name, begin, end }, max_events);
+}
+
+const char* Tracer::Impl::intern(const std::string& name) {
+    return names.insert(name).first->c_str();
+}
+
+std::optional<int64_t> Tracer::Impl::gpu_clock_offset(float timestamp_period) {
+    if (!calibrated)
+        return std::nullopt;
+    VkCalibratedTimestampInfoEXT infos[] = {
+        { .sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .timeDomain = VK_TIME_DOMAIN_DEVICE_EXT },
+        { .sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .timeDomain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT },
+    };
+    uint64_t timestamps[2];
+    uint64_t max_deviation;
+    if (device.dispatch.getCalibratedTimestampsEXT(2, infos, timestamps, &max_deviation) != VK_SUCCESS)
+        return std::nullopt;
+    return static_cast<int64_t>(timestamps[1]) - static_cast<int64_t>(timestamps[0] * (double) timestamp_period);
+}
+
+Tracer::Tracer(Device& device, size_t max_events) {
+    _impl = std::make_unique<Impl>(device, max_events);
+    Impl* expected = nullptr;
+    if (!device._impl->tracer.compare_exchange_strong(expected, _impl.get()))
+        throw std::runtime_error("There is a Tracer for this Device already");
+}
+
+Tracer::~Tracer() {
+    _impl->device._impl->tracer = nullptr;
+}
+
+Tracer::Span::Span(Device& device, const char* name) : tracer(device._impl->tracer), name(name) {
+    if (tracer)
+        begin = imr_get_time_nano();
+}
+
+void Tracer::Span::end() {
+    if (tracer)
+        tracer->record(name, begin, imr_get_time_nano());
+    tracer = nullptr;
+}
+
+Tracer::Span::~Span() {
+    end();
+}
+
+static void write_json_string(FILE* file, const char* str) {
+    fputc('"', file);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\')
+            fprintf(file, "\\%c", *str);
+        else if (static_cast<unsigned char>(*str) < 0x20)
+            fprintf(file, "\\u%04x", *str);
+        else
+            fputc(*str, file);
+    }
+    fputc('"', file);
+}
+
+void Tracer::writeJson(FILE* file) {
+    // Times are in microseconds, from when the tracer was created
+    auto write_event = [&](const char* name, uint32_t tid, uint64_t begin, uint64_t end) {
+        fprintf(file, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%" PRIu32 ",\"name\":", tid);
+        write_json_string(file, name);
+        fprintf(file, ",\"ts\":%.3f,\"dur\":%.3f}", ((int64_t) (begin - _impl->start)) / 1000.0, (end - begin) / 1000.0);
+    };
+
+    std::unique_lock lock(_impl->mutex);
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"ph\":\"M\",\"pid\":1,\"tid\":0,\"name\":\"thread_name\",\"args\":{\"name\":\"GPU\"}}");
+    _impl->gpu_events.for_each([&](auto& event) { write_event(event.name, 0, event.begin, event.end); });
+    // how many events each track lost to the cap, those are the oldest
+    std::string dropped = "\"GPU\":" + std::to_string(_impl->gpu_events.dropped);
+    for (auto& buffer : _impl->threads) {
+        std::unique_lock buffer_lock(buffer->mutex);
+        fprintf(file, ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%" PRIu32 ",\"name\":\"thread_name\",\"args\":{\"name\":\"Thread %" PRIu32 "\"}}", buffer->tid, buffer->tid);
+        buffer->events.for_each([&](auto& event) { write_event(event.name, buffer->tid, event.begin, event.end); });
+        dropped += ",\"Thread " + std::to_string(buffer->tid) + "\":" + std::to_string(buffer->events.dropped);
+    }
+    fprintf(file, "\n],\n\"otherData\":{\"max_events\":%zu,\"dropped_events\":{%s}}}\n", _impl->max_events, dropped.c_str());
+}
+
+bool Tracer::writeJson(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file)
+        return false;
+    writeJson(file);
+    return fclose(file) == 0;
+}
+
+}
@@ -0,0 +1,321 @@
+#include "swapchain_private.h"
+
+namespace imr {
+
+static const size_t upload_staging_capacity = 64 * 1024 * 1024;
+
+struct UploadEngine::Impl {
+    Device& device;
+    VkQueue queue;
+    uint32_t queue_family;
+    /// Uploads happen on another queue family than rendering, so ownership of the resources has to be handed over
+    bool ownership_transfer;
+
+    VkCommandPool pool;
+    VkSemaphore timeline;
+    uint64_t last_value = 0;
+    /// Last value a frame was made to wait on
+    uint64_t acquired_value = 0;
+    std::unique_ptr<StagingRing> staging;
+
+    VkCommandBuffer recording = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> free_command_buffers;
+
+    struct Submission {
+        uint64_t value;
+        VkCommandBuffer cmdbuf;
+        StagingRing::Mark mark;
+    };
+    std::deque<Submission> in_flight;
+
+    /// Recorded when the current command buffer is flushed, in one go
+    std::vector<VkBufferMemoryBarrier2> buffer_releases;
+    std::vector<VkImageMemoryBarrier2> image_releases;
+    /// Recorded on the main queue by acquire()
+    std::vector<VkBufferMemoryBarrier2> buffer_acquires;
+    std::vector<VkImageMemoryBarrier2> image_acquires;
+
+    Impl(Device&);
+    ~Impl();
+
+    /// Recycles the command buffers and staging space of finished submissions
+    void retire();
+    VkCommandBuffer command_buffer();
+};
+
+UploadEngine::Impl::Impl(Device& device) : device(device) {
+    ownership_transfer = device.transfer_queue != VK_NULL_HANDLE;
+    queue = ownership_transfer ? device.transfer_queue : device.main_queue;
+    queue_family = ownership_transfer ? device.transfer_queue_idx : device.main_queue_idx;
+
+    CHECK_VK_THROW(vkCreateCommandPool(device.device, tmpPtr((VkCommandPoolCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = queue_family,
+    }), nullptr, &pool));
+
+    CHECK_VK_THROW(vkCreateSemaphore(device.device, tmpPtr((VkSemaphoreCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = tmpPtr((VkSemaphoreTypeCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+            .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+            .initialValue = 0,
+        }),
+    }), nullptr, &timeline));
+
+    staging = std::make_unique<StagingRing>(device, upload_staging_capacity);
+}
+
+UploadEngine::Impl::~Impl() {
+    CHECK_VK_THROW(vkWaitSemaphores(device.device, tmpPtr((VkSemaphoreWaitInfo) {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &timeline,
+        .pValues = &last_value,
+    }), UINT64_MAX));
+    staging.reset();
+    // this frees all the command buffers, including one we might still be recording
+    vkDestroyCommandPool(device.device, pool, nullptr);
+    vkDestroySemaphore(device.device, timeline, nullptr);
+}
+
+void UploadEngine::Impl::retire() {
+    uint64_t completed;
+    CHECK_VK_THROW(vkGetSemaphoreCounterValue(device.device, timeline, &completed));
+    while (!in_flight.empty() && in_flight.front().value <= completed) {
+        auto& submission = in_flight.front();
+        staging->release(submission.mark);
+        free_command_buffers.push_back(submission.cmdbuf);
+        in_flight.pop_front();
+    }
+}
+
+VkCommandBuffer UploadEngine::Impl::command_buffer() {
+    if (recording)
+        return recording;
+
+    retire();
+    if (free_command_buffers.empty()) {
+        CHECK_VK_THROW(vkAllocateCommandBuffers(device.device, tmpPtr((VkCommandBufferAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        }), &recording));
+    } else {
+        recording = free_command_buffers.back();
+        free_command_buffers.pop_back();
+    }
+
+    // this implicitly resets the command buffer
+    CHECK_VK_THROW(vkBeginCommandBuffer(recording, tmpPtr((VkCommandBufferBeginInfo) {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    })));
+    return recording;
+}
+
+UploadEngine::UploadEngine(Device& device) {
+    _impl = std::make_unique<Impl>(device);
+}
+
+UploadEngine::~UploadEngine() = default;
+
+void UploadEngine::uploadBuffer(Buffer& buffer, uint64_t offset, uint64_t size, const void* data) {
+    VkCommandBuffer cmdbuf = _impl->command_buffer();
+    auto [staging_buffer, staging_offset] = _impl->staging->stage(size, data);
+
+    vkCmdCopyBuffer2(cmdbuf, tmpPtr((VkCopyBufferInfo2) {
+        .sType = VK_STRUCTURE_TYPE_COPY_BUFFER_INFO_2,
+        .srcBuffer = staging_buffer,
+        .dstBuffer = buffer.handle,
+        .regionCount = 1,
+        .pRegions = tmpPtr((VkBufferCopy2) {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2,
+            .srcOffset = staging_offset,
+            .dstOffset = offset,
+            .size = size,
+        })
+    }));
+
+    // Without an ownership transfer, the semaphore the frame waits on already makes the copy visible
+    if (!_impl->ownership_transfer)
+        return;
+
+    VkBufferMemoryBarrier2 barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+        .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_2_NONE,
+        .dstAccessMask = VK_ACCESS_2_NONE,
+        .srcQueueFamilyIndex = _impl->queue_family,
+        .dstQueueFamilyIndex = _impl->device.main_queue_idx,
+        .buffer = buffer.handle,
+        .offset = offset,
+        .size = size,
+    };
+    _impl->buffer_releases.push_back(barrier);
+
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+    barrier.srcAccessMask = VK_ACCESS_2_NONE;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+    _impl->buffer_acquires.push_back(barrier);
+}
+
+void UploadEngine::uploadImage(Image& image, const void* data, size_t size, VkImageLayout final_layout) {
+    auto& vk = _impl->device.dispatch;
+    VkCommandBuffer cmdbuf = _impl->command_buffer();
+    auto [staging_buffer, staging_offset] = _impl->staging->stage(size, data);
+
+    // before the barrier: nothing, the previous contents are discarded
+    // after the barrier: the copy writes the image
+    vk.cmdPipelineBarrier2KHR(cmdbuf, tmpPtr((VkDependencyInfo) {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .imageMemoryBarrierCount = 1,
+        .pImageMemoryBarriers = tmpPtr((VkImageMemoryBarrier2) {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_NONE,
+            .srcAccessMask = VK_ACCESS_2_NONE,
+            .dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+            .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .image = image.handle(),
+            .subresourceRange = image.whole_image_subresource_range(),
+        }),
+    }));
+
+    vkCmdCopyBufferToImage2(cmdbuf, tmpPtr((VkCopyBufferToImageInfo2) {
+        .sType = VK_STRUCTURE_TYPE_COPY_BUFFER_TO_IMAGE_INFO_2,
+        .srcBuffer = staging_buffer,
+        .dstImage = image.handle(),
+        .dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .regionCount = 1,
+        .pRegions = tmpPtr((VkBufferImageCopy2) {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_IMAGE_COPY_2,
+            .bufferOffset = staging_offset,
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource = {
+                .aspectMask = image.whole_image_subresource_range().aspectMask,
+                .mipLevel = 0,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+            .imageOffset = { 0, 0, 0 },
+            .imageExtent = image.size(),
+        }),
+    }));
+
+    // The layout transition happens as part of the release (and again in the matching acquire), or in a plain barrier if we stay on the same queue
+    VkImageMemoryBarrier2 barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+        .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_2_NONE,
+        .dstAccessMask = VK_ACCESS_2_NONE,
+        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .newLayout = final_layout,
+        .srcQueueFamilyIndex = _impl->ownership_transfer ? _impl->queue_family : VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = _impl->ownership_transfer ? _impl->device.main_queue_idx : VK_QUEUE_FAMILY_IGNORED,
+        .image = image.handle(),
+        .subresourceRange = image.whole_image_subresource_range(),
+    };
+    _impl->image_releases.push_back(barrier);
+    // That's where it is for the main queue once acquire() ran, with the copy made visible by the semaphore and the acquire barrier
+    image.state() = { .layout = final_layout };
+
+    if (!_impl->ownership_transfer)
+        return;
+
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+    barrier.srcAccessMask = VK_ACCESS_2_NONE;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+    _impl->image_acquires.push_back(barrier);
+}
+
+uint64_t UploadEngine::flush() {
+    auto& device = _impl->device;
+    auto& vk = device.dispatch;
+    VkCommandBuffer cmdbuf = _impl->recording;
+    if (!cmdbuf)
+        return _impl->last_value;
+
+    if (!_impl->buffer_releases.empty() || !_impl->image_releases.empty()) {
+        vk.cmdPipelineBarrier2KHR(cmdbuf, tmpPtr((VkDependencyInfo) {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .bufferMemoryBarrierCount = static_cast<uint32_t>(_impl->buffer_releases.size()),
+            .pBufferMemoryBarriers = _impl->buffer_releases.data(),
+            .imageMemoryBarrierCount = static_cast<uint32_t>(_impl->image_releases.size()),
+            .pImageMemoryBarriers = _impl->image_releases.data(),
+        }));
+        _impl->buffer_releases.clear();
+        _impl->image_releases.clear();
+    }
+    CHECK_VK_THROW(vkEndCommandBuffer(cmdbuf));
+
+    uint64_t value = ++_impl->last_value;
+    Tracer::Span submit_span(_impl->device, "submit uploads");
+    CHECK_VK_THROW(vkQueueSubmit(_impl->queue, 1, tmpPtr((VkSubmitInfo) {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = tmpPtr((VkTimelineSemaphoreSubmitInfo) {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .signalSemaphoreValueCount = 1,
+            .pSignalSemaphoreValues = &value,
+        }),
+        .commandBufferCount = 1,
+        .pCommandBuffers = &cmdbuf,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &_impl->timeline,
+    }), VK_NULL_HANDLE));
+    submit_span.end();
+
+    _impl->in_flight.push_back({ value, cmdbuf, _impl->staging->mark() });
+    _impl->recording = VK_NULL_HANDLE;
+    return value;
+}
+
+void UploadEngine::acquire(Swapchain::Frame& frame, VkCommandBuffer cmdbuf) {
+    auto& vk = _impl->device.dispatch;
+    flush();
+
+    if (_impl->last_value > _impl->acquired_value) {
+        frame.addWaitSemaphore(_impl->timeline, _impl->last_value, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+        _impl->acquired_value = _impl->last_value;
+    }
+
+    if (!_impl->buffer_acquires.empty() || !_impl->image_acquires.empty()) {
+        vk.cmdPipelineBarrier2KHR(cmdbuf, tmpPtr((VkDependencyInfo) {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .bufferMemoryBarrierCount = static_cast<uint32_t>(_impl->buffer_acquires.size()),
+            .pBufferMemoryBarriers = _impl->buffer_acquires.data(),
+            .imageMemoryBarrierCount = static_cast<uint32_t>(_impl->image_acquires.size()),
+            .pImageMemoryBarriers = _impl->image_acquires.data(),
+        }));
+        _impl->buffer_acquires.clear();
+        _impl->image_acquires.clear();
+    }
+}
+
+VkSemaphore UploadEngine::timeline() const { return _impl->timeline; }
+
+bool UploadEngine::isDone(uint64_t value) {
+    _impl->retire();
+    uint64_t completed;
+    CHECK_VK_THROW(vkGetSemaphoreCounterValue(_impl->device.device, _impl->timeline, &completed));
+    return completed >= value;
+}
+
+void UploadEngine::wait(uint64_t value) {
+    CHECK_VK_THROW(vkWaitSemaphores(_impl->device.device, tmpPtr((VkSemaphoreWaitInfo) {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &_impl->timeline,
+        .pValues = &value,
+    }), UINT64_MAX));
+    _impl->retire();
+}
+
+}
@@ -3,18 +3,27 @@
 #include <stdlib.h>
 
 #include <stdint.h>
+// This is used for measuring intervals and pacing frames, so it has to be monotonic: wall-clock time can jump around.
 #if defined(__MINGW64__) | defined(__MINGW32__)
 #include <pthread.h>
 uint64_t imr_get_time_nano() {
     struct timespec t;
-    clock_gettime(CLOCK_REALTIME, &t);
+    clock_gettime(CLOCK_MONOTONIC, &t);
     return t.tv_sec * 1000000000 + t.tv_nsec;
 }
+#elif defined(_MSC_VER)
+#include <windows.h>
+uint64_t imr_get_time_nano(void) {
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t) ((counter.QuadPart / frequency.QuadPart) * 1000000000 + ((counter.QuadPart % frequency.QuadPart) * 1000000000) / frequency.QuadPart);
+}
 #else
 #include <time.h>
 uint64_t imr_get_time_nano(void) {
     struct timespec t;
-    timespec_get(&t, TIME_UTC);
+    clock_gettime(CLOCK_MONOTONIC, &t);
     return t.tv_sec * 1000000000 + t.tv_nsec;
 }
 #endif